@@ -0,0 +1,41 @@
+/******************************************************************************
+Arduino.cpp
+Virtual clock and Serial for the host-side Arduino stand-in.
+******************************************************************************/
+
+#include "Arduino.h"
+
+HostSerial Serial;
+
+static unsigned long hostMicros = 0;
+
+unsigned long millis(void)
+{
+	return hostMicros / 1000;
+}
+
+unsigned long micros(void)
+{
+	return hostMicros;
+}
+
+void delay(unsigned long ms)
+{
+	hostMicros += ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	hostMicros += us;
+}
+
+void yield(void)
+{
+	hostMicros += 1;
+}
+
+// Used by simulated devices to charge bus time to the virtual clock
+void hostAdvanceMicros(unsigned long us)
+{
+	hostMicros += us;
+}
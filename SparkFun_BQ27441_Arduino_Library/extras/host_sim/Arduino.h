@@ -0,0 +1,81 @@
+/******************************************************************************
+Arduino.h
+Host-side stand-in for the Arduino core, used by the BQ27441 simulator.
+
+Only the pieces the BQ27441 library and its sketch helpers touch are provided:
+fixed-width types, a virtual clock (delay/millis/micros), constrain(), the
+F()/PROGMEM flash helpers and a printf-backed Serial without input.
+******************************************************************************/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t  uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef int8_t   sint8;
+typedef int16_t  sint16;
+typedef int32_t  sint32;
+typedef bool     boolean;
+typedef uint8_t  byte;
+
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#include <algorithm>
+using std::min;
+using std::max;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+// Flash helpers are plain memory on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr)  (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)  (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define memcpy_P memcpy
+#define strcmp_P strcmp
+#define strlen_P strlen
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+// Virtual clock: delay() advances time instantly so simulations run at full speed
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+void hostAdvanceMicros(unsigned long us);
+
+class HostSerial {
+public:
+	void begin(unsigned long) {}
+	void print(const char * s) { fputs(s, stdout); }
+	void print(const __FlashStringHelper * s) { fputs(reinterpret_cast<const char *>(s), stdout); }
+	void print(char c) { putchar(c); }
+	void print(int v) { printf("%d", v); }
+	void print(unsigned int v) { printf("%u", v); }
+	void print(long v) { printf("%ld", v); }
+	void print(unsigned long v) { printf("%lu", v); }
+	void print(unsigned short v) { printf("%u", v); }
+	void print(short v) { printf("%d", v); }
+	void print(unsigned char v) { printf("%u", v); }
+	void print(double v, int digits = 2) { printf("%.*f", digits, v); }
+	template <typename T> void print(const T & v) { fputs(v.c_str(), stdout); }
+	template <size_t N> void print(const char (& s)[N]) { fputs(s, stdout); }
+	template <typename T> void println(T v) { print(v); putchar('\n'); }
+	void println(double v, int digits) { print(v, digits); putchar('\n'); }
+	void println(void) { putchar('\n'); }
+	// No serial input on the host
+	void setTimeout(unsigned long) {}
+	size_t readBytesUntil(char, char *, size_t) { return 0; }
+};
+extern HostSerial Serial;
+
+#endif
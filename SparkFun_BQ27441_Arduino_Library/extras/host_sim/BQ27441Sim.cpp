@@ -0,0 +1,395 @@
+/******************************************************************************
+BQ27441Sim.cpp
+Host-side BQ27441-G1A register and Data Memory simulator
+******************************************************************************/
+
+#include "BQ27441Sim.h"
+
+// Default R_a table of the ROM image
+static const uint16_t defaultRaTable[15] = {102,102,99,107,72,59,62,63,53,47,60,70,140,369,588};
+
+BQ27441Sim::BQ27441Sim() : _dmCount(0)
+{
+	_timing.transactionUs = 120;
+	_timing.byteUs = 90;
+	_timing.initCompUs = 20000;
+	_timing.cfgEnterUs = 1500;
+	_timing.cfgExitUs = 3000;
+	powerOnReset();
+}
+
+void BQ27441Sim::attach(TwoWire & wire, uint8_t address)
+{
+	wire.attach(address, this);
+	powerOnReset();
+}
+
+void BQ27441Sim::powerOnReset(void)
+{
+	memset(&_stats, 0, sizeof(_stats));
+	memset(_regs, 0, sizeof(_regs));
+	memset(_dm, 0, sizeof(_dm));
+	_dmCount = 0;
+
+	addClass(49, 32);  // Discharge
+	_dm[0].data[0] = 10; _dm[0].data[1] = 15; // SOC1 set/clear
+	_dm[0].data[2] = 2;  _dm[0].data[3] = 5;  // SOCF set/clear
+	addClass(64, 32);  // Registers
+	setDM16(64, 0, 0x25F8);                   // OpConfig
+	addClass(80, 64);  // IT Cfg
+	addClass(82, 64);  // State
+	setDM16(82, 0, 16384);                    // Qmax
+	setDM16(82, 10, 1000);                    // Design Capacity
+	setDM16(82, 12, 3800);                    // Design Energy
+	setDM16(82, 16, 3200);                    // Terminate Voltage
+	findClass(82)->data[26] = 1;              // SOCI Delta
+	setDM16(82, 27, 100);                     // Taper Rate
+	addClass(89, 32);  // R_a RAM
+	for (int i = 0; i < 15; i++)
+		setDM16(89, i * 2, defaultRaTable[i]);
+	addClass(112, 32); // Codes
+
+	setReg(0x02, 2982);  // Temperature (0.1K)
+	setReg(0x04, 3850);  // Voltage
+	setReg(0x08, 1650);  // NominalAvailableCapacity
+	setReg(0x0A, 3100);  // FullAvailableCapacity
+	setReg(0x0C, 1600);  // RemainingCapacity
+	setReg(0x0E, 3050);  // FullChargeCapacity
+	setReg(0x10, (uint16_t)-85);   // AverageCurrent
+	setReg(0x12, (uint16_t)-10);   // StandbyCurrent
+	setReg(0x14, (uint16_t)-500);  // MaxLoadCurrent
+	setReg(0x18, (uint16_t)-327);  // AveragePower
+	setReg(0x1C, 52);    // StateOfCharge
+	setReg(0x1E, 3011);  // InternalTemperature
+	setReg(0x20, 0x0362);// StateOfHealth: status 3, 98%
+	setReg(0x28, 1610);
+	setReg(0x2A, 1600);
+	setReg(0x2C, 3060);
+	setReg(0x2E, 3050);
+	setReg(0x30, 53);    // StateOfChargeUnfiltered
+
+	_sealed = true;
+	_itpor = true;
+	_busError = false;
+	_unsealStep = 0;
+	_controlStatus = 0;
+	_controlResult = 0;
+	_statusResult = true;
+	_porAt = micros();
+	_cfgPending = false;
+	_exitPending = false;
+	_cfgEnterAt = 0;
+	_cfgExitAt = 0;
+	_readPointer = 0;
+	_socIntBase = 52;
+	_gpoutPulses = 0;
+	_gpoutPulseAt = 0;
+	_blockEnabled = false;
+	_blockClass = 0;
+	_blockIndex = 0;
+	memset(_block, 0, sizeof(_block));
+}
+
+void BQ27441Sim::addClass(uint8_t id, uint8_t size)
+{
+	if (_dmCount >= BQ27441_SIM_DM_CLASSES)
+		return;
+	_dm[_dmCount].id = id;
+	_dm[_dmCount].size = size;
+	_dmCount++;
+}
+
+BQ27441Sim::DMClass * BQ27441Sim::findClass(uint8_t id)
+{
+	for (uint8_t i = 0; i < _dmCount; i++)
+	{
+		if (_dm[i].id == id)
+			return &_dm[i];
+	}
+	return NULL;
+}
+
+const uint8_t * BQ27441Sim::dataMemory(uint8_t classID) const
+{
+	for (uint8_t i = 0; i < _dmCount; i++)
+	{
+		if (_dm[i].id == classID)
+			return _dm[i].data;
+	}
+	return NULL;
+}
+
+// Data Memory is big-endian
+void BQ27441Sim::setDM16(uint8_t id, uint8_t offset, uint16_t value)
+{
+	DMClass * dm = findClass(id);
+	dm->data[offset] = value >> 8;
+	dm->data[offset + 1] = value & 0xFF;
+}
+
+// Standard commands are little-endian
+void BQ27441Sim::setReg(uint8_t command, uint16_t value)
+{
+	_regs[command] = value & 0xFF;
+	_regs[command + 1] = value >> 8;
+}
+
+uint16_t BQ27441Sim::reg(uint8_t command) const
+{
+	return ((uint16_t)_regs[command + 1] << 8) | _regs[command];
+}
+
+void BQ27441Sim::setSoc(uint8_t percent)
+{
+	setReg(0x1C, percent);
+	setReg(0x30, percent);
+	const uint8_t * state = dataMemory(82);
+	const uint8_t * regs = dataMemory(64);
+	bool batLowEn = regs[1] & 0x04;
+	uint8_t delta = state[26] ? state[26] : 1;
+	int moved = (int)percent - (int)_socIntBase;
+	if (moved < 0) moved = -moved;
+	if (!batLowEn && moved >= delta)
+	{
+		_socIntBase = percent;
+		pulseGpout();
+	}
+}
+
+bool BQ27441Sim::configMode(void) const
+{
+	if (_exitPending && micros() >= _cfgExitAt)
+		return false;
+	return _cfgPending && micros() >= _cfgEnterAt;
+}
+
+uint16_t BQ27441Sim::flags(void) const
+{
+	uint16_t f = 0x0008; // BAT_DET
+	if (_itpor && !(_exitPending && micros() >= _cfgExitAt))
+		f |= 0x0020;
+	if (configMode())
+		f |= 0x0010;
+	if ((int16_t)reg(0x10) < 0)
+		f |= 0x0001;
+	if (reg(0x1C) >= 100)
+		f |= 0x0200;
+	return f;
+}
+
+uint16_t BQ27441Sim::controlStatus(void) const
+{
+	uint16_t s = _controlStatus;
+	if (_sealed)
+		s |= 0x2000;
+	if (micros() - _porAt >= _timing.initCompUs)
+		s |= 0x0080;
+	return s;
+}
+
+int BQ27441Sim::gpoutLevel(void) const
+{
+	bool activeHigh = dataMemory(64)[0] & 0x08; // GPIOPOL is bit 11 (MSB first)
+	bool active = _gpoutPulses && (micros() - _gpoutPulseAt) < 1000;
+	return (active == activeHigh) ? HIGH : LOW;
+}
+
+void BQ27441Sim::pulseGpout(void)
+{
+	_gpoutPulses++;
+	_gpoutPulseAt = micros();
+}
+
+// Apply mode transitions whose delay has elapsed
+void BQ27441Sim::settle(void)
+{
+	if (_exitPending && micros() >= _cfgExitAt)
+	{
+		_exitPending = false;
+		_cfgPending = false;
+		_itpor = false;
+	}
+}
+
+void BQ27441Sim::charge(uint8_t bytes)
+{
+	uint32_t us = _timing.transactionUs + (uint32_t)bytes * _timing.byteUs;
+	_stats.busMicros += us;
+	hostAdvanceMicros(us);
+}
+
+void BQ27441Sim::control(uint16_t subcommand)
+{
+	if (subcommand == 0x8000)
+	{
+		if (++_unsealStep >= 2)
+		{
+			_sealed = false;
+			_unsealStep = 0;
+		}
+		_statusResult = true;
+		return;
+	}
+	_unsealStep = 0;
+	_statusResult = true;
+
+	switch (subcommand)
+	{
+	case 0x00: break;                                   // CONTROL_STATUS
+	case 0x01: _controlResult = 0x0421; _statusResult = false; break; // DEVICE_TYPE
+	case 0x02: _controlResult = 0x0109; _statusResult = false; break; // FW_VERSION
+	case 0x04: _controlResult = 0x0048; _statusResult = false; break; // DM_CODE
+	case 0x08: _controlResult = 0x0128; _statusResult = false; break; // CHEM_ID
+	case 0x13:                                          // SET_CFGUPDATE
+		if (!_sealed && !_cfgPending)
+		{
+			_cfgPending = true;
+			_exitPending = false;
+			_cfgEnterAt = micros() + _timing.cfgEnterUs;
+			_stats.configEntries++;
+		}
+		break;
+	case 0x20: _sealed = true; break;                   // SEALED
+	case 0x23: if (!(dataMemory(64)[1] & 0x04)) pulseGpout(); break; // PULSE_SOC_INT
+	case 0x42:                                          // SOFT_RESET
+		if (_cfgPending && !_sealed)
+		{
+			_exitPending = true;
+			_cfgExitAt = micros() + _timing.cfgExitUs;
+		}
+		break;
+	case 0x43:                                          // EXIT_CFGUPDATE
+	case 0x44:                                          // EXIT_RESIM
+		_cfgPending = false;
+		_exitPending = false;
+		_itpor = false;
+		break;
+	default:
+		break;
+	}
+}
+
+void BQ27441Sim::loadBlock(void)
+{
+	memset(_block, 0, sizeof(_block));
+	DMClass * dm = findClass(_blockClass);
+	if (_sealed || dm == NULL)
+		return;
+	uint16_t start = (uint16_t)_blockIndex * 32;
+	for (uint16_t i = 0; i < 32 && start + i < dm->size; i++)
+		_block[i] = dm->data[start + i];
+}
+
+void BQ27441Sim::commitBlock(uint8_t csum)
+{
+	uint8_t sum = 0;
+	for (int i = 0; i < 32; i++)
+		sum += _block[i];
+	DMClass * dm = findClass(_blockClass);
+	if (!configMode() || _sealed || dm == NULL || csum != (uint8_t)(255 - sum))
+	{
+		_stats.dmRejects++;
+		return;
+	}
+	uint16_t start = (uint16_t)_blockIndex * 32;
+	for (uint16_t i = 0; i < 32 && start + i < dm->size; i++)
+		dm->data[start + i] = _block[i];
+	_stats.dmCommits++;
+}
+
+void BQ27441Sim::writeByte(uint8_t address, uint8_t value)
+{
+	if (address == 0x3E)       // DataClass()
+	{
+		_blockClass = value;
+		_blockIndex = 0;
+		loadBlock();
+	}
+	else if (address == 0x3F)  // DataBlock()
+	{
+		_blockIndex = value;
+		loadBlock();
+	}
+	else if (address >= 0x40 && address < 0x60)  // BlockData()
+	{
+		if (_blockEnabled)
+			_block[address - 0x40] = value;
+	}
+	else if (address == 0x60)  // BlockDataCheckSum()
+	{
+		commitBlock(value);
+	}
+	else if (address == 0x61)  // BlockDataControl()
+	{
+		_blockEnabled = (value == 0x00);
+	}
+}
+
+uint8_t BQ27441Sim::readByte(uint8_t address)
+{
+	if (address == 0x00)
+		return (_statusResult ? controlStatus() : _controlResult) & 0xFF;
+	if (address == 0x01)
+		return (_statusResult ? controlStatus() : _controlResult) >> 8;
+	if (address == 0x06)
+		return flags() & 0xFF;
+	if (address == 0x07)
+		return flags() >> 8;
+	if (address == 0x3A)
+		return dataMemory(64)[1];
+	if (address == 0x3B)
+		return dataMemory(64)[0];
+	if (address == 0x3C)
+		return dataMemory(82)[11];
+	if (address == 0x3D)
+		return dataMemory(82)[10];
+	if (address < 0x3A)
+		return _regs[address];
+	if (address == 0x3E)
+		return _blockClass;
+	if (address == 0x3F)
+		return _blockIndex;
+	if (address >= 0x40 && address < 0x60)
+		return _block[address - 0x40];
+	if (address == 0x60)
+	{
+		uint8_t sum = 0;
+		for (int i = 0; i < 32; i++)
+			sum += _block[i];
+		return 255 - sum;
+	}
+	return 0;
+}
+
+bool BQ27441Sim::i2cWrite(const uint8_t * data, uint8_t count)
+{
+	settle();
+	charge(count + 1);
+	_stats.writeTransactions++;
+	_stats.bytesWritten += count;
+	if (_busError || count == 0)
+		return !_busError;
+
+	_readPointer = data[0];
+	if (count == 3 && data[0] == 0x00)
+	{
+		control(((uint16_t)data[2] << 8) | data[1]);
+		return true;
+	}
+	for (uint8_t i = 1; i < count; i++)
+		writeByte(data[0] + i - 1, data[i]);
+	return true;
+}
+
+uint8_t BQ27441Sim::i2cRead(uint8_t * data, uint8_t count)
+{
+	settle();
+	charge(count + 1);
+	_stats.readTransactions++;
+	if (_busError)
+		return 0;
+	_stats.bytesRead += count;
+	for (uint8_t i = 0; i < count; i++)
+		data[i] = readByte(_readPointer + i);
+	return count;
+}
@@ -0,0 +1,138 @@
+/******************************************************************************
+BQ27441Sim.h
+Host-side BQ27441-G1A register and Data Memory simulator
+
+Models the parts of the gauge the library talks to: the standard command
+window, Control() subcommands, seal/unseal, CFGUPDATE and soft-reset
+transitions, BlockData class/offset paging with checksum commit, and the
+GPOUT SOC_INT pulse. Every transaction is charged to the virtual clock and
+counted, so driver changes can be compared by bus cost without hardware.
+******************************************************************************/
+
+#ifndef BQ27441Sim_h
+#define BQ27441Sim_h
+
+#include "Arduino.h"
+#include <Wire.h>
+
+#define BQ27441_SIM_DM_CLASSES 8
+#define BQ27441_SIM_DM_SIZE    64
+
+// Bus accounting, reset with BQ27441Sim::resetStats()
+typedef struct {
+	uint32_t writeTransactions; // endTransmission() calls addressed to the gauge
+	uint32_t readTransactions;  // requestFrom() calls addressed to the gauge
+	uint32_t bytesWritten;      // Including the sub-address byte
+	uint32_t bytesRead;
+	uint32_t busMicros;         // Virtual time charged for all of the above
+	uint32_t dmCommits;         // Accepted BlockDataCheckSum() writes
+	uint32_t dmRejects;         // Rejected checksum writes (bad sum or not in CFGUPDATE)
+	uint32_t configEntries;     // SET_CFGUPDATE subcommands accepted
+} bq27441_sim_stats;
+
+// Timing model, all values in microseconds of virtual time
+typedef struct {
+	uint32_t transactionUs;  // Fixed cost per transaction (start, address, stop)
+	uint32_t byteUs;         // Cost per data byte (~90us at 100kHz)
+	uint32_t initCompUs;     // POR until CONTROL_STATUS[INITCOMP] is set
+	uint32_t cfgEnterUs;     // SET_CFGUPDATE until Flags()[CFGUPMODE] is set
+	uint32_t cfgExitUs;      // SOFT_RESET until Flags()[CFGUPMODE] is cleared
+} bq27441_sim_timing;
+
+class BQ27441Sim : public I2CDevice {
+public:
+	BQ27441Sim();
+
+	/**
+	    Attach the simulator to a bus at the given address and apply a
+		power-on reset.
+	*/
+	void attach(TwoWire & wire, uint8_t address = 0x55);
+
+	/**
+	    Power-on reset: Data Memory back to ROM defaults, sealed, ITPOR set.
+	*/
+	void powerOnReset(void);
+
+	// Scenario controls
+	void setTiming(const bq27441_sim_timing & timing) { _timing = timing; }
+	void setSealed(bool sealed) { _sealed = sealed; }
+	void setVoltage(uint16_t mV) { setReg(0x04, mV); }
+	void setAverageCurrent(int16_t mA) { setReg(0x10, (uint16_t)mA); }
+	void setRemainingCapacity(uint16_t mAh) { setReg(0x0C, mAh); }
+	void setSoc(uint8_t percent);
+	void setStatusBits(uint16_t bits) { _controlStatus |= bits; }
+	void clearStatusBits(uint16_t bits) { _controlStatus &= ~bits; }
+	void setBusError(bool fail) { _busError = fail; }
+
+	// Inspection
+	const bq27441_sim_stats & stats(void) const { return _stats; }
+	void resetStats(void) { memset(&_stats, 0, sizeof(_stats)); }
+	bool sealed(void) const { return _sealed; }
+	bool configMode(void) const;
+	uint16_t flags(void) const;
+	uint16_t controlStatus(void) const;
+	uint16_t reg(uint8_t command) const;
+	const uint8_t * dataMemory(uint8_t classID) const;
+	uint32_t gpoutPulses(void) const { return _gpoutPulses; }
+
+	/**
+	    Level of the simulated GPOUT line at the current virtual time. SOC_INT
+		pulses are 1 ms wide and follow OpConfig[GPIOPOL].
+	*/
+	int gpoutLevel(void) const;
+
+	// I2CDevice
+	virtual bool i2cWrite(const uint8_t * data, uint8_t count);
+	virtual uint8_t i2cRead(uint8_t * data, uint8_t count);
+
+private:
+	struct DMClass {
+		uint8_t id;
+		uint8_t size;
+		uint8_t data[BQ27441_SIM_DM_SIZE];
+	};
+
+	bq27441_sim_timing _timing;
+	bq27441_sim_stats _stats;
+	uint8_t _regs[0x40];
+	DMClass _dm[BQ27441_SIM_DM_CLASSES];
+	uint8_t _dmCount;
+
+	bool _sealed;
+	bool _itpor;
+	bool _busError;
+	uint8_t _unsealStep;
+	uint16_t _controlStatus;
+	uint16_t _controlResult;
+	bool _statusResult;   // Control() reads return CONTROL_STATUS
+	uint32_t _porAt;
+	bool _cfgPending;     // CFGUPMODE requested / active
+	uint32_t _cfgEnterAt; // Virtual time CFGUPMODE becomes visible
+	bool _exitPending;
+	uint32_t _cfgExitAt;  // Virtual time a soft-reset exit completes
+	uint8_t _readPointer;
+	uint8_t _socIntBase;
+	uint32_t _gpoutPulses;
+	uint32_t _gpoutPulseAt;
+
+	bool _blockEnabled;
+	uint8_t _blockClass;
+	uint8_t _blockIndex;
+	uint8_t _block[32];
+
+	DMClass * findClass(uint8_t id);
+	void addClass(uint8_t id, uint8_t size);
+	void setDM16(uint8_t id, uint8_t offset, uint16_t value);
+	void setReg(uint8_t command, uint16_t value);
+	void loadBlock(void);
+	void commitBlock(uint8_t csum);
+	void control(uint16_t subcommand);
+	void settle(void);
+	void pulseGpout(void);
+	void writeByte(uint8_t address, uint8_t value);
+	uint8_t readByte(uint8_t address);
+	void charge(uint8_t bytes);
+};
+
+#endif
@@ -0,0 +1,85 @@
+/******************************************************************************
+TCA9548ASim.cpp
+Host-side TCA9548A I2C multiplexer simulator
+******************************************************************************/
+
+#include "TCA9548ASim.h"
+
+// Bus cost of a control register write: transaction plus two bytes at 100kHz
+#define TCA9548A_SIM_WRITE_US (120 + 2 * 90)
+
+TCA9548ASim::TCA9548ASim() : _wire(NULL), _control(0), _controlWrites(0), _addressCount(0)
+{
+	memset(_devices, 0, sizeof(_devices));
+}
+
+void TCA9548ASim::attach(TwoWire & wire, uint8_t address)
+{
+	_wire = &wire;
+	_control = 0;
+	wire.attach(address, this);
+}
+
+void TCA9548ASim::attachDevice(uint8_t channel, uint8_t address, I2CDevice * device)
+{
+	if (_wire == NULL || channel >= TCA9548A_SIM_CHANNELS)
+		return;
+
+	uint8_t slot = 0;
+	while (slot < _addressCount && _downstream[slot].address != address)
+		slot++;
+	if (slot == _addressCount)
+	{
+		if (_addressCount == TCA9548A_SIM_ADDRESSES)
+			return;
+		_downstream[slot].mux = this;
+		_downstream[slot].address = address;
+		_wire->attach(address, &_downstream[slot]);
+		_addressCount++;
+	}
+	_devices[channel][slot] = device;
+}
+
+bool TCA9548ASim::i2cWrite(const uint8_t * data, uint8_t count)
+{
+	hostAdvanceMicros(TCA9548A_SIM_WRITE_US);
+	_controlWrites++;
+	if (count != 1)
+		return false;
+	_control = data[0];
+	return true;
+}
+
+uint8_t TCA9548ASim::i2cRead(uint8_t * data, uint8_t count)
+{
+	hostAdvanceMicros(TCA9548A_SIM_WRITE_US);
+	for (uint8_t i = 0; i < count; i++)
+		data[i] = _control;
+	return count;
+}
+
+I2CDevice * TCA9548ASim::route(uint8_t slot) const
+{
+	I2CDevice * found = NULL;
+	for (uint8_t channel = 0; channel < TCA9548A_SIM_CHANNELS; channel++)
+	{
+		if (!(_control & (1 << channel)) || _devices[channel][slot] == NULL)
+			continue;
+		if (found)
+			return NULL; // Two devices answer at once, the transfer is garbled
+		found = _devices[channel][slot];
+	}
+	return found;
+}
+
+bool TCA9548ASim::Downstream::i2cWrite(const uint8_t * data, uint8_t count)
+{
+	I2CDevice * device = mux->route(this - mux->_downstream);
+	return device && device->i2cWrite(data, count);
+}
+
+uint8_t TCA9548ASim::Downstream::i2cRead(uint8_t * data, uint8_t count)
+{
+	I2CDevice * device = mux->route(this - mux->_downstream);
+	return device ? device->i2cRead(data, count) : 0;
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+TCA9548ASim.h
+Host-side TCA9548A I2C multiplexer simulator
+
+Devices attached to a channel are reachable only while that channel is
+enabled in the control register, so several simulated gauges can share the
+0x55 address. Control register writes are charged to the virtual clock and
+counted.
+******************************************************************************/
+
+#ifndef TCA9548ASim_h
+#define TCA9548ASim_h
+
+#include "Arduino.h"
+#include <Wire.h>
+
+#define TCA9548A_SIM_CHANNELS 8
+#define TCA9548A_SIM_ADDRESSES 4 // Distinct downstream addresses
+
+class TCA9548ASim : public I2CDevice {
+public:
+	TCA9548ASim();
+
+	/**
+	    Attach the mux to a bus at the given address, all channels disabled.
+	*/
+	void attach(TwoWire & wire, uint8_t address = 0x70);
+
+	/**
+	    Put a simulated device on a channel. Call attach() first.
+	*/
+	void attachDevice(uint8_t channel, uint8_t address, I2CDevice * device);
+
+	// Inspection
+	uint8_t control(void) const { return _control; }
+	uint32_t controlWrites(void) const { return _controlWrites; }
+	void resetStats(void) { _controlWrites = 0; }
+
+	// I2CDevice: the control register
+	virtual bool i2cWrite(const uint8_t * data, uint8_t count);
+	virtual uint8_t i2cRead(uint8_t * data, uint8_t count);
+
+private:
+	// Stands in for the downstream devices of one address on the upstream bus
+	class Downstream : public I2CDevice {
+	public:
+		TCA9548ASim * mux;
+		uint8_t address;
+		virtual bool i2cWrite(const uint8_t * data, uint8_t count);
+		virtual uint8_t i2cRead(uint8_t * data, uint8_t count);
+	};
+
+	TwoWire * _wire;
+	uint8_t _control;
+	uint32_t _controlWrites;
+	I2CDevice * _devices[TCA9548A_SIM_CHANNELS][TCA9548A_SIM_ADDRESSES];
+	Downstream _downstream[TCA9548A_SIM_ADDRESSES];
+	uint8_t _addressCount;
+
+	/**
+	    The one device at an address on the enabled channels, NULL if there
+		is none, or if more than one answers.
+	*/
+	I2CDevice * route(uint8_t slot) const;
+};
+
+#endif
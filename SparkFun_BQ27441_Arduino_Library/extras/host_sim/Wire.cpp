@@ -0,0 +1,86 @@
+/******************************************************************************
+Wire.cpp
+Host-side stand-in for the Arduino TwoWire (I2C master) library.
+******************************************************************************/
+
+#include "Wire.h"
+
+TwoWire Wire;
+
+TwoWire::TwoWire() : _txAddress(0), _txLength(0), _txOverflow(false), _rxLength(0), _rxIndex(0)
+{
+	memset(_devices, 0, sizeof(_devices));
+}
+
+void TwoWire::begin(void)
+{
+}
+
+void TwoWire::attach(uint8_t address, I2CDevice * device)
+{
+	_devices[address & 0x7F] = device;
+}
+
+void TwoWire::detach(uint8_t address)
+{
+	_devices[address & 0x7F] = NULL;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+	_txAddress = address & 0x7F;
+	_txLength = 0;
+	_txOverflow = false;
+}
+
+// Return codes follow the Arduino core: 0 success, 1 data too long,
+// 2 NACK on address, 3 NACK on data, 4 other error
+uint8_t TwoWire::endTransmission(bool sendStop)
+{
+	(void)sendStop;
+	if (_txOverflow)
+		return 1;
+	I2CDevice * device = _devices[_txAddress];
+	if (device == NULL)
+		return 2;
+	if (!device->i2cWrite(_txBuffer, _txLength))
+		return 3;
+	return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool sendStop)
+{
+	(void)sendStop;
+	_rxIndex = 0;
+	_rxLength = 0;
+	if (quantity > BUFFER_LENGTH)
+		quantity = BUFFER_LENGTH;
+	I2CDevice * device = _devices[address & 0x7F];
+	if (device == NULL)
+		return 0;
+	_rxLength = device->i2cRead(_rxBuffer, quantity);
+	return _rxLength;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+	if (_txLength >= BUFFER_LENGTH)
+	{
+		_txOverflow = true;
+		return 0;
+	}
+	_txBuffer[_txLength++] = data;
+	return 1;
+}
+
+int TwoWire::available(void)
+{
+	return _rxLength - _rxIndex;
+}
+
+int TwoWire::read(void)
+{
+	if (_rxIndex >= _rxLength)
+		return -1;
+	return _rxBuffer[_rxIndex++];
+}
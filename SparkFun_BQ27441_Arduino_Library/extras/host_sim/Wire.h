@@ -0,0 +1,56 @@
+/******************************************************************************
+Wire.h
+Host-side stand-in for the Arduino TwoWire (I2C master) library.
+
+Transactions are routed to simulated devices attached by 7-bit address. The
+32-byte Wire buffer limit of the real cores is enforced so burst sizes that
+work here also work on the target.
+******************************************************************************/
+
+#ifndef TwoWire_h
+#define TwoWire_h
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 32
+
+// A simulated I2C target. write() receives one complete write transaction
+// (sub-address first); read() serves one requestFrom() transaction.
+class I2CDevice {
+public:
+	virtual ~I2CDevice() {}
+	virtual bool i2cWrite(const uint8_t * data, uint8_t count) = 0;
+	virtual uint8_t i2cRead(uint8_t * data, uint8_t count) = 0;
+};
+
+class TwoWire {
+public:
+	TwoWire();
+
+	void begin(void);
+	void setClock(uint32_t) {}
+	void beginTransmission(uint8_t address);
+	uint8_t endTransmission(bool sendStop = true);
+	uint8_t requestFrom(uint8_t address, uint8_t quantity, bool sendStop = true);
+	size_t write(uint8_t data);
+	int available(void);
+	int read(void);
+
+	// Simulation hooks
+	void attach(uint8_t address, I2CDevice * device);
+	void detach(uint8_t address);
+
+private:
+	I2CDevice * _devices[128];
+	uint8_t _txAddress;
+	uint8_t _txBuffer[BUFFER_LENGTH];
+	uint8_t _txLength;
+	bool _txOverflow;
+	uint8_t _rxBuffer[BUFFER_LENGTH];
+	uint8_t _rxLength;
+	uint8_t _rxIndex;
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,98 @@
+/******************************************************************************
+bus_cost.cpp
+Runs common BQ27441 library operations against the simulator and reports
+what each one cost on the bus.
+
+Build and run from this directory:
+g++ -std=gnu++11 -I. -I../../src -o bus_cost Arduino.cpp Wire.cpp BQ27441Sim.cpp \
+    TCA9548ASim.cpp bus_cost.cpp ../../src/SparkFunBQ27441.cpp ../../src/BQ27441_Mux.cpp \
+    ../../src/BQ27441_Collector.cpp && ./bus_cost
+******************************************************************************/
+
+#include "BQ27441Sim.h"
+#include "TCA9548ASim.h"
+#include <SparkFunBQ27441.h>
+#include <BQ27441_Collector.h>
+
+BQ27441Sim sim;
+BQ27441 lipo;
+
+// A pack bank: four gauges behind a mux on a second bus
+#define BANK_GAUGES 4
+TwoWire bankBus;
+TCA9548ASim muxSim;
+BQ27441Sim bankSim[BANK_GAUGES];
+TCA9548A mux;
+BQ27441 bank[BANK_GAUGES];
+
+// Print the bus cost of the last operation and start a new count
+static void report(const char * operation, bool ok)
+{
+	const bq27441_sim_stats & s = sim.stats();
+	printf("%-16s %-4s tx %3u w / %3u r  bytes %4u / %4u  bus %6u us  commits %u  cfg %u\n",
+		operation, ok ? "ok" : "FAIL",
+		s.writeTransactions, s.readTransactions, s.bytesWritten, s.bytesRead,
+		s.busMicros, s.dmCommits, s.configEntries);
+	sim.resetStats();
+}
+
+int main(void)
+{
+	bool ok;
+
+	sim.attach(Wire);
+	ok = lipo.begin();
+	report("begin", ok);
+
+	delay(30); // Let INITCOMP set
+
+	ok = lipo.voltage() > 0;
+	lipo.soc();
+	lipo.current(AVG);
+	lipo.capacity(REMAIN);
+	report("4 getters", ok);
+
+	bq27441_snapshot data;
+	ok = lipo.snapshot(data);
+	report("snapshot", ok);
+
+	ok = lipo.setCapacity(3000, 11100);
+	report("setCapacity", ok && lipo.capacity(DESIGN) == 3000);
+
+	ok = lipo.setCapacity(3000, 11100);
+	report("setCapacity same", ok);
+
+	{
+		BQ27441::ConfigSession config(lipo);
+		ok = config.active();
+		ok &= lipo.setCapacity(2800, 10360);
+		ok &= lipo.setTerminateVoltage(3100);
+		ok &= lipo.setTaperRate(150);
+	}
+	report("3 writes/session", ok && !sim.configMode());
+
+	muxSim.attach(bankBus);
+	for (int i = 0; i < BANK_GAUGES; i++)
+	{
+		muxSim.attachDevice(i, 0x55, &bankSim[i]);
+		bankSim[i].setSoc(20 * (i + 1));
+	}
+	ok = mux.begin(bankBus);
+	for (int i = 0; i < BANK_GAUGES; i++)
+		ok &= bank[i].begin(mux, i);
+	bankSim[2].setBusError(true); // One gauge stops answering
+	muxSim.resetStats();
+
+	BQ27441Collector collector(bank, BANK_GAUGES);
+	bq27441_gauge_result results[BANK_GAUGES];
+	bq27441_pass_stats pass;
+	collector.collect(results, &pass);
+	printf("%-16s %-4s gauges %u  failed %u  mux writes %u  pass %u us  slowest %u us\n",
+		"collect bank", ok ? "ok" : "FAIL", pass.gauges, pass.failed,
+		muxSim.controlWrites(), pass.micros, pass.maxMicros);
+	for (int i = 0; i < BANK_GAUGES; i++)
+		printf("  gauge %d  %-4s soc %3u%%  %5u us\n", i, results[i].error == BQ27441_OK ? "ok" : "FAIL",
+			results[i].data.soc, results[i].micros);
+
+	return 0;
+}
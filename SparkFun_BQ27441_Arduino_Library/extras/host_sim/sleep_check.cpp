@@ -0,0 +1,69 @@
+/******************************************************************************
+sleep_check.cpp
+Checks the sketch's sleepInterval() against readings of the simulated gauge:
+the fixed-timer fallback while the cost of a wake is unknown, charging, and
+the interval stretching from its minimum to its maximum as the charge runs
+down.
+
+Build and run from this directory:
+g++ -std=gnu++11 -I. -I../../src -I../../../sketch_thingspeak -o sleep_check \
+    Arduino.cpp Wire.cpp BQ27441Sim.cpp sleep_check.cpp ../../src/SparkFunBQ27441.cpp \
+    ../../src/BQ27441_Mux.cpp ../../../sketch_thingspeak/sleep_schedule.cpp && ./sleep_check
+******************************************************************************/
+
+#include "BQ27441Sim.h"
+#include <SparkFunBQ27441.h>
+#include <sleep_schedule.h>
+
+BQ27441Sim sim;
+BQ27441 lipo;
+
+// The sketch's budget: 90 days, 30 s to 30 min, 60 uA asleep
+const SleepBudget budget = { 90, 30, 1800, 60 };
+
+static int failures = 0;
+
+static void check(const char * scenario, uint32 got, uint32 expected)
+{
+	bool ok = (got == expected);
+	printf("%-28s %-4s %lu s\n", scenario, ok ? "ok" : "FAIL", (unsigned long)got);
+	if (!ok)
+		failures++;
+}
+
+// What the sketch passes in: the gauge now, and the last wake's current and length
+static uint32 interval(int16_t wakeCurrent, uint32 awakeMs)
+{
+	SleepInputs inputs = { (uint8)lipo.soc(), lipo.capacity(FULL), wakeCurrent, awakeMs };
+	return sleepInterval(budget, inputs);
+}
+
+int main(void)
+{
+	sim.attach(Wire);
+	lipo.begin();
+	delay(30); // Let INITCOMP set
+
+	// A wake of 4 s drawing 85 mA, from a 3050 mAh battery
+	sim.setAverageCurrent(-85);
+	int16_t wakeCurrent = lipo.current(AVG);
+
+	sim.setSoc(50);
+	check("current unknown", interval(0, 4000), 0);
+	check("wake length unknown", interval(wakeCurrent, 0), 0);
+	check("charging", interval(200, 4000), budget.minInterval);
+
+	sim.setSoc(100);
+	check("full, light wake", interval(-1, 4000), budget.minInterval);
+	check("full", interval(wakeCurrent, 4000), 247);
+	sim.setSoc(50);
+	check("half", interval(wakeCurrent, 4000), 521);
+	check("half, shorter wake", interval(wakeCurrent, 2000), 260);
+	sim.setSoc(10);
+	check("10%, capped", interval(wakeCurrent, 4000), budget.maxInterval);
+	sim.setSoc(2);
+	check("below the sleep draw", interval(wakeCurrent, 4000), budget.maxInterval);
+
+	printf("%s\n", failures ? "FAILED" : "all passed");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+/******************************************************************************
+wake_check.cpp
+Checks the sketch's wakeClassify() against the simulated GPOUT line: a gauge
+wake (BAT_LOW held, SOC_INT while asleep, sleep until RST), a timer wake and a
+power-on.
+
+Build and run from this directory:
+g++ -std=gnu++11 -I. -I../../src -I../../../sketch_thingspeak -o wake_check \
+    Arduino.cpp Wire.cpp BQ27441Sim.cpp wake_check.cpp ../../src/SparkFunBQ27441.cpp \
+    ../../src/BQ27441_Mux.cpp ../../../sketch_thingspeak/wake_classify.cpp && ./wake_check
+******************************************************************************/
+
+#include "BQ27441Sim.h"
+#include <SparkFunBQ27441.h>
+#include <wake_classify.h>
+
+BQ27441Sim sim;
+BQ27441 lipo;
+
+const WakePolicy soc_policy = { true, SOC_INT, 1, 1800000000, 0 };
+const WakePolicy timer_policy = { false, SOC_INT, 1, 0, WAKE_NO_PIN };
+
+static int failures = 0;
+
+static const char * name(WakeSource source)
+{
+	switch (source)
+	{
+	case WAKE_POWER_ON: return "power-on";
+	case WAKE_TIMER:    return "timer";
+	default:            return "gauge";
+	}
+}
+
+static void check(const char * scenario, WakeSource got, WakeSource expected)
+{
+	bool ok = (got == expected);
+	printf("%-28s %-4s %s\n", scenario, ok ? "ok" : "FAIL", name(got));
+	if (!ok)
+		failures++;
+}
+
+// GPOUT is active-low and wired to RST, as the sketch programs it
+static bool gpoutAsserted(void)
+{
+	return sim.gpoutLevel() == LOW;
+}
+
+int main(void)
+{
+	sim.attach(Wire);
+	lipo.begin();
+	delay(30); // Let INITCOMP set
+	{
+		BQ27441::ConfigSession config(lipo, true);
+		lipo.setGPOUTPolarity(false);
+		lipo.setGPOUTFunction(SOC_INT);
+		lipo.setSOCIDelta(soc_policy.socDelta);
+	}
+	delay(100);
+
+	uint8 sleepSoc = lipo.soc();
+	check("power-on", wakeClassify(soc_policy, false, 60000, gpoutAsserted(), WAKE_SOC_UNKNOWN,
+		lipo.soc()), WAKE_POWER_ON);
+
+	// The timer ran out, the SoC didn't move
+	delay(60000);
+	check("timer, SoC still", wakeClassify(soc_policy, true, 60000, gpoutAsserted(), sleepSoc,
+		lipo.soc()), WAKE_TIMER);
+
+	// SOC_INT pulses RST, GPOUT is still low when it is sensed right away
+	sim.setSoc(sleepSoc - 1);
+	check("SOC_INT, line asserted", wakeClassify(soc_policy, true, 60000, gpoutAsserted(),
+		WAKE_SOC_UNKNOWN, WAKE_SOC_UNKNOWN), WAKE_GAUGE);
+
+	// Boot takes longer than the 1 ms pulse, only the SoC marker tells
+	delay(200);
+	check("SOC_INT, pulse over", wakeClassify(soc_policy, true, 60000, gpoutAsserted(), sleepSoc,
+		lipo.soc()), WAKE_GAUGE);
+
+	// Without the gauge read, the pulse can't be told from a timer wake
+	check("SOC_INT, SoC unknown", wakeClassify(soc_policy, true, 60000, gpoutAsserted(), sleepSoc,
+		WAKE_SOC_UNKNOWN), WAKE_TIMER);
+
+	check("sleep until RST", wakeClassify(soc_policy, true, 0, gpoutAsserted(), sleepSoc,
+		sleepSoc), WAKE_GAUGE);
+
+	// GPOUT not wired to RST: every deep-sleep wake is the timer
+	check("no gauge wake, SoC moved", wakeClassify(timer_policy, true, 60000, false, sleepSoc,
+		sleepSoc - 1), WAKE_TIMER);
+
+	printf("%s\n", failures ? "FAILED" : "all passed");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,50 @@
+/******************************************************************************
+BQ27441_Collector.cpp
+Batched polling of several BQ27441 LiPo Fuel Gauges
+
+Implementation of the BQ27441Collector class, see BQ27441_Collector.h.
+
+Hardware Resources:
+- Arduino Development Board
+- TCA9548A 8-channel I2C multiplexer
+- SparkFun Battery Babysitter (one per channel)
+
+Development environment specifics:
+Arduino 1.6.7
+SparkFun Battery Babysitter v1.0
+Arduino Uno (any 'duino should do)
+******************************************************************************/
+
+#include "BQ27441_Collector.h"
+
+// Read every gauge once, one snapshot() burst per gauge
+uint8_t BQ27441Collector::collect(bq27441_gauge_result * results, bq27441_pass_stats * stats)
+{
+	unsigned long passStart = micros();
+	uint32_t maxMicros = 0;
+	uint8_t good = 0;
+
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		unsigned long start = micros();
+		_gauges[i].clearError();
+		if (!_gauges[i].snapshot(results[i].data))
+			memset(&results[i].data, 0, sizeof(results[i].data));
+		results[i].error = _gauges[i].lastError();
+		results[i].micros = micros() - start;
+
+		if (results[i].error == BQ27441_OK)
+			good++;
+		if (results[i].micros > maxMicros)
+			maxMicros = results[i].micros;
+	}
+
+	if (stats)
+	{
+		stats->micros = micros() - passStart;
+		stats->maxMicros = maxMicros;
+		stats->gauges = _count;
+		stats->failed = _count - good;
+	}
+	return good;
+}
@@ -0,0 +1,80 @@
+/******************************************************************************
+BQ27441_Collector.h
+Batched polling of several BQ27441 LiPo Fuel Gauges
+
+A collect() pass reads the standard command window of every gauge with
+snapshot(), one burst per gauge, and reports the result of each gauge and
+the timing of the pass. Give the gauges in mux channel order, so the pass
+switches channels once per gauge.
+
+    BQ27441 pack[4];   // Started with pack[i].begin(mux, i)
+    BQ27441Collector collector(pack, 4);
+    bq27441_gauge_result results[4];
+    bq27441_pass_stats pass;
+
+    collector.collect(results, &pass);
+
+Hardware Resources:
+- Arduino Development Board
+- TCA9548A 8-channel I2C multiplexer
+- SparkFun Battery Babysitter (one per channel)
+
+Development environment specifics:
+Arduino 1.6.7
+SparkFun Battery Babysitter v1.0
+Arduino Uno (any 'duino should do)
+******************************************************************************/
+
+#ifndef BQ27441_Collector_h
+#define BQ27441_Collector_h
+
+#include "SparkFunBQ27441.h"
+
+// Result of one gauge in a collect() pass
+typedef struct {
+	bq27441_snapshot data; // Standard command window, zero-filled if the read failed
+	bq27441_error error;   // BQ27441_OK, or the error that failed the read
+	uint32_t micros;       // Time spent on this gauge (us)
+} bq27441_gauge_result;
+
+// Timing of one collect() pass
+typedef struct {
+	uint32_t micros;     // Whole pass (us)
+	uint32_t maxMicros;  // Slowest gauge (us)
+	uint8_t gauges;      // Gauges polled
+	uint8_t failed;      // Gauges whose read failed
+} bq27441_pass_stats;
+
+class BQ27441Collector {
+public:
+	/**
+	    BQ27441Collector constructor
+
+		@param gauges is an array of started BQ27441s
+		@param count is the number of gauges in the array
+	*/
+	BQ27441Collector(BQ27441 * gauges, uint8_t count) : _gauges(gauges), _count(count) {}
+
+	/**
+	    Read every gauge once. The lastError() of each gauge is cleared
+		at the start of its read.
+
+		@param results is an array of one result per gauge
+		@param stats is where the pass timing is stored, NULL if not needed
+		@return number of gauges read successfully
+	*/
+	uint8_t collect(bq27441_gauge_result * results, bq27441_pass_stats * stats = NULL);
+
+	/**
+	    Get the number of gauges
+
+		@return number of gauges polled by collect()
+	*/
+	uint8_t count(void) { return _count; }
+
+private:
+	BQ27441 * _gauges;
+	uint8_t _count;
+};
+
+#endif
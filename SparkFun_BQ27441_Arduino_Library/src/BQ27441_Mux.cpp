@@ -0,0 +1,60 @@
+/******************************************************************************
+BQ27441_Mux.cpp
+TCA9548A I2C Multiplexer for BQ27441 LiPo Fuel Gauges
+
+Implementation of the TCA9548A class, see BQ27441_Mux.h.
+
+Hardware Resources:
+- Arduino Development Board
+- TCA9548A 8-channel I2C multiplexer
+- SparkFun Battery Babysitter (one per channel)
+
+Development environment specifics:
+Arduino 1.6.7
+SparkFun Battery Babysitter v1.0
+Arduino Uno (any 'duino should do)
+******************************************************************************/
+
+#include "BQ27441_Mux.h"
+
+TCA9548A::TCA9548A(uint8_t address) : _i2cPort(&Wire), _address(address), _selected(TCA9548A_NO_CHANNEL)
+{
+}
+
+// Initializes I2C and disables all channels.
+bool TCA9548A::begin(TwoWire & wirePort)
+{
+	_i2cPort = &wirePort;
+	_i2cPort->begin(); // Initialize I2C master
+
+	return disable();
+}
+
+// Connects one channel to the bus, unless it is connected already.
+uint8_t TCA9548A::select(uint8_t channel)
+{
+	if (channel >= TCA9548A_CHANNELS)
+		return 4; // Not a channel, reported like a Wire "other error"
+	if (channel == _selected)
+		return 0;
+
+	uint8_t status = writeControl(1 << channel);
+	_selected = (status == 0) ? channel : TCA9548A_NO_CHANNEL;
+	return status;
+}
+
+// Disconnects all channels from the bus
+bool TCA9548A::disable(void)
+{
+	uint8_t status = writeControl(0);
+	_selected = TCA9548A_NO_CHANNEL;
+	return (status == 0);
+}
+
+// Write the control register, one bit per channel
+uint8_t TCA9548A::writeControl(uint8_t control)
+{
+	_i2cPort->beginTransmission(_address);
+	_i2cPort->write(control);
+	return _i2cPort->endTransmission(true);
+}
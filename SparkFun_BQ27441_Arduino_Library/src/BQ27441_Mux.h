@@ -0,0 +1,106 @@
+/******************************************************************************
+BQ27441_Mux.h
+TCA9548A I2C Multiplexer for BQ27441 LiPo Fuel Gauges
+
+Every BQ27441 answers at address 0x55, so a bus with more than one gauge puts
+each of them on a channel of a TCA9548A. A BQ27441 started with
+begin(mux, channel) selects its channel before each transfer. The mux
+remembers the selected channel, so a run of transfers to one gauge costs a
+single channel switch.
+
+    TCA9548A mux;
+    BQ27441 pack[2];
+
+    mux.begin();
+    pack[0].begin(mux, 0);
+    pack[1].begin(mux, 1);
+
+Hardware Resources:
+- Arduino Development Board
+- TCA9548A 8-channel I2C multiplexer
+- SparkFun Battery Babysitter (one per channel)
+
+Development environment specifics:
+Arduino 1.6.7
+SparkFun Battery Babysitter v1.0
+Arduino Uno (any 'duino should do)
+******************************************************************************/
+
+#ifndef BQ27441_Mux_h
+#define BQ27441_Mux_h
+
+#include "Arduino.h"
+#include <Wire.h>
+
+#define TCA9548A_I2C_ADDRESS 0x70 // Default I2C address of the TCA9548A (A0~A2 low)
+#define TCA9548A_CHANNELS    8
+#define TCA9548A_NO_CHANNEL  0xFF // No channel selected, or selection unknown
+
+class TCA9548A {
+public:
+	/**
+	    TCA9548A constructor
+
+		@param address is the I2C address of the mux (0x70~0x77)
+	*/
+	TCA9548A(uint8_t address = TCA9548A_I2C_ADDRESS);
+
+	/**
+	    Initializes I2C and disables all channels.
+
+		@param wirePort is the I2C bus the mux is on
+		@return true if the mux acknowledged
+	*/
+	bool begin(TwoWire & wirePort = Wire);
+
+	/**
+	    Connects one channel to the bus and disconnects the others. Nothing
+		is sent if the channel is already selected.
+
+		@param channel is the channel to select (0~7)
+		@return the Wire.endTransmission() status, 0 on success
+	*/
+	uint8_t select(uint8_t channel);
+
+	/**
+	    Disconnects all channels from the bus
+
+		@return true on success
+	*/
+	bool disable(void);
+
+	/**
+	    Forgets the selected channel, so the next select() is always sent.
+		Call it if the mux may have been reset, or written by other code.
+	*/
+	void forget(void) { _selected = TCA9548A_NO_CHANNEL; }
+
+	/**
+	    Get the selected channel
+
+		@return channel (0~7), or TCA9548A_NO_CHANNEL
+	*/
+	uint8_t selected(void) { return _selected; }
+
+	/**
+	    Get the I2C bus the mux is on
+
+		@return the TwoWire given to begin()
+	*/
+	TwoWire & wire(void) { return *_i2cPort; }
+
+private:
+	TwoWire * _i2cPort;  // I2C bus of the mux and its channels
+	uint8_t _address;    // I2C address of the mux
+	uint8_t _selected;   // Channel connected to the bus, TCA9548A_NO_CHANNEL if unknown
+
+	/**
+	    Write the control register
+
+		@param control is the channel enable bitmap
+		@return the Wire.endTransmission() status
+	*/
+	uint8_t writeControl(uint8_t control);
+};
+
+#endif
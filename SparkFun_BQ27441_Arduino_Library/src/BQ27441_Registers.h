@@ -0,0 +1,120 @@
+/******************************************************************************
+BQ27441_Registers.h
+BQ27441 LiPo Fuel Gauge Typed Register Map
+
+Compile-time descriptors of the BQ27441 standard and extended commands:
+address, width, signedness and unit of each register. BQ27441::read<>() uses
+them to read one register, or a group of registers in one I2C burst, with the
+transfer and the decoding worked out at compile time.
+
+    uint16_t mV = lipo.read<BQ27441Reg::Voltage>();
+
+    uint16_t soc;
+    int16_t mA;
+    lipo.read<BQ27441Reg::AverageCurrent, BQ27441Reg::StateOfCharge>(mA, soc);
+
+Hardware Resources:
+- Arduino Development Board
+- SparkFun Battery Babysitter
+
+Development environment specifics:
+Arduino 1.6.7
+SparkFun Battery Babysitter v1.0
+Arduino Uno (any 'duino should do)
+******************************************************************************/
+
+#ifndef BQ27441_Registers_h
+#define BQ27441_Registers_h
+
+#include <stdint.h>
+#include "BQ27441_Definitions.h"
+
+namespace BQ27441Reg {
+
+// Unit of a register value
+typedef enum {
+	UNIT_NONE,    // Bit field or raw value
+	UNIT_MV,      // mV
+	UNIT_MA,      // mA, >0 indicates charging
+	UNIT_MAH,     // mAh
+	UNIT_MW,      // mW, >0 indicates charging
+	UNIT_PERCENT, // %
+	UNIT_DK       // 0.1 K
+} unit;
+
+// Value type of a register of the given width and signedness
+template <uint8_t Width, bool Signed> struct Value;
+template <> struct Value<1, false> { typedef uint8_t type; };
+template <> struct Value<2, false> { typedef uint16_t type; };
+template <> struct Value<2, true>  { typedef int16_t type; };
+
+// Raw little-endian value of a register of the given width
+template <uint8_t Width> struct LittleEndian;
+template <> struct LittleEndian<1> {
+	static uint8_t get(const uint8_t * data) { return data[0]; }
+};
+template <> struct LittleEndian<2> {
+	static uint16_t get(const uint8_t * data) { return ((uint16_t)data[1] << 8) | data[0]; }
+};
+
+// A little-endian register of the standard or extended command window
+template <uint8_t Address, uint8_t Width, bool Signed, unit Unit>
+struct Register {
+	static const uint8_t address = Address;
+	static const uint8_t width = Width;
+	static const bool isSigned = Signed;
+	static const unit units = Unit;
+	typedef typename Value<Width, Signed>::type type;
+
+	// Decode the register from the bytes read at its address
+	static type decode(const uint8_t * data)
+	{
+		return (type)LittleEndian<Width>::get(data);
+	}
+};
+
+// Standard commands
+struct Temperature      : Register<BQ27441_COMMAND_TEMP,           2, false, UNIT_DK>      {};
+struct Voltage          : Register<BQ27441_COMMAND_VOLTAGE,        2, false, UNIT_MV>      {};
+struct Flags            : Register<BQ27441_COMMAND_FLAGS,          2, false, UNIT_NONE>    {};
+struct NomAvailCapacity : Register<BQ27441_COMMAND_NOM_CAPACITY,   2, false, UNIT_MAH>     {};
+struct FullAvailCapacity: Register<BQ27441_COMMAND_AVAIL_CAPACITY, 2, false, UNIT_MAH>     {};
+struct RemCapacity      : Register<BQ27441_COMMAND_REM_CAPACITY,   2, false, UNIT_MAH>     {};
+struct FullCapacity     : Register<BQ27441_COMMAND_FULL_CAPACITY,  2, false, UNIT_MAH>     {};
+struct AverageCurrent   : Register<BQ27441_COMMAND_AVG_CURRENT,    2, true,  UNIT_MA>      {};
+struct StandbyCurrent   : Register<BQ27441_COMMAND_STDBY_CURRENT,  2, true,  UNIT_MA>      {};
+struct MaxLoadCurrent   : Register<BQ27441_COMMAND_MAX_CURRENT,    2, true,  UNIT_MA>      {};
+struct AveragePower     : Register<BQ27441_COMMAND_AVG_POWER,      2, true,  UNIT_MW>      {};
+struct StateOfCharge    : Register<BQ27441_COMMAND_SOC,            2, false, UNIT_PERCENT> {};
+struct InternalTemp     : Register<BQ27441_COMMAND_INT_TEMP,       2, false, UNIT_DK>      {};
+struct SohPercent       : Register<BQ27441_COMMAND_SOH,            1, false, UNIT_PERCENT> {};
+struct SohStatus        : Register<BQ27441_COMMAND_SOH + 1,        1, false, UNIT_NONE>    {};
+struct RemCapUnfl       : Register<BQ27441_COMMAND_REM_CAP_UNFL,   2, false, UNIT_MAH>     {};
+struct RemCapFil        : Register<BQ27441_COMMAND_REM_CAP_FIL,    2, false, UNIT_MAH>     {};
+struct FullCapUnfl      : Register<BQ27441_COMMAND_FULL_CAP_UNFL,  2, false, UNIT_MAH>     {};
+struct FullCapFil       : Register<BQ27441_COMMAND_FULL_CAP_FIL,   2, false, UNIT_MAH>     {};
+struct StateOfChargeUnfl: Register<BQ27441_COMMAND_SOC_UNFL,       2, false, UNIT_PERCENT> {};
+
+// Extended commands
+struct OpConfig         : Register<BQ27441_EXTENDED_OPCONFIG,      2, false, UNIT_NONE>    {};
+struct DesignCapacity   : Register<BQ27441_EXTENDED_CAPACITY,      2, false, UNIT_MAH>     {};
+
+// First address and end (last address + 1) of a group of registers
+template <typename... Regs> struct Span;
+
+template <typename Reg>
+struct Span<Reg> {
+	static const uint8_t first = Reg::address;
+	static const uint8_t end = Reg::address + Reg::width;
+};
+
+template <typename Reg, typename... Rest>
+struct Span<Reg, Rest...> {
+	static const uint8_t first = (Reg::address < Span<Rest...>::first) ? Reg::address : Span<Rest...>::first;
+	static const uint8_t end = (Reg::address + Reg::width > Span<Rest...>::end) ?
+	                           Reg::address + Reg::width : Span<Rest...>::end;
+};
+
+} // namespace BQ27441Reg
+
+#endif
@@ -16,6 +16,23 @@ Modified by D. Chao:
 - Added Qmax() and setQmax() - To improve initial accuracy of battery fuel gauge.
 - Added RaTable() and setRaTable() - To read and set the R_a RAM Table.
 - Changed readExtendedData() parameters to read a block of data instead of a byte.
+- Added snapshot() - To read the whole standard command window in one I2C burst.
+- Changed readExtendedData() to read the 32-byte BlockData() window in one burst and 
+  serve it from a block buffer.
+- Added ConfigSession - To share one config mode entry among many Data Memory accesses.
+- Added beginStagedWrites() and commitStagedWrites() - To coalesce Data Memory writes,
+  one load and one diff-only commit per block.
+- Added beginEnterConfig(), beginExitConfig(), beginWaitInit() and poll() - To wait for
+  mode changes without blocking.
+- Added profileBus() - To count I2C transactions, bytes and wait time per command group.
+- Changed the I2C routines to return bq27441_error codes and to give up on a read after
+  a microsecond deadline (setI2CTimeout()). Errors are reported by lastError().
+- Added read<>() and the typed register map (BQ27441_Registers.h) - To read registers,
+  or a group of them in one burst, with the transfer worked out at compile time.
+- Added designEnergy(), taperRate(), terminateVoltage() and dmCode() - To read back the
+  battery configuration.
+- Added begin(wirePort) and begin(mux, channel) - To use another I2C bus, or one channel
+  of a TCA9548A mux (BQ27441_Mux.h) so more than one gauge can share a bus.
 
 
 Hardware Resources:
@@ -33,20 +50,33 @@ Arduino Uno (any 'duino should do)
 #include "SparkFunBQ27441.h"
 #include "BQ27441_Definitions.h"
 
+// Operations advanced by poll()
+#define BQ27441_POLL_NONE         0
+#define BQ27441_POLL_ENTER_CONFIG 1
+#define BQ27441_POLL_EXIT_CONFIG  2
+#define BQ27441_POLL_INIT         3
+
 /*****************************************************************************
  ************************** Initialization Functions *************************
  *****************************************************************************/
 // Initializes class variables
-BQ27441::BQ27441() : _deviceAddress(BQ72441_I2C_ADDRESS), _sealFlag(false), _userConfigControl(false)
+BQ27441::BQ27441() : _deviceAddress(BQ72441_I2C_ADDRESS), _i2cPort(&Wire), _mux(NULL), _muxChannel(0),
+                     _sealFlag(false), _userConfigControl(false),
+                     _blockClass(0), _blockIndex(0), _blockValid(false),
+                     _staging(false), _stagePending(false), _stageSuccess(true),
+                     _pollOp(BQ27441_POLL_NONE), _pollStart(0), _busStats(NULL),
+                     _timeoutMicros(BQ27441_I2C_DEADLINE), _lastError(BQ27441_OK), _transferError(BQ27441_OK)
 {
 }
 
 // Initializes I2C and verifies communication with the BQ27441.
-bool BQ27441::begin(void)
+bool BQ27441::begin(TwoWire & wirePort)
 {
 	uint16_t deviceID = 0;
 	
-	Wire.begin(); // Initialize I2C master
+	_i2cPort = &wirePort;
+	_mux = NULL;
+	_i2cPort->begin(); // Initialize I2C master
 	
 	deviceID = deviceType(); // Read deviceType from BQ27441
 	
@@ -58,6 +88,18 @@ bool BQ27441::begin(void)
 	return false; // Otherwise return false
 }
 
+// Verifies communication with a BQ27441 on a mux channel. The mux has
+// initialized I2C already.
+bool BQ27441::begin(TCA9548A & mux, uint8_t channel)
+{
+	_i2cPort = &mux.wire();
+	_mux = &mux;
+	_muxChannel = channel;
+	_blockValid = false; // Block buffer may hold another gauge's data
+	
+	return (deviceType() == BQ27441_DEVICE_ID);
+}
+
 // Configures the design capacity and energy of the connected battery 
 // (capacity=0~8000) (energy=0~32767).
 bool BQ27441::setCapacity(uint16_t capacity, uint16_t energy)
@@ -75,6 +117,14 @@ bool BQ27441::setCapacity(uint16_t capacity, uint16_t energy)
 	return writeExtendedData(BQ27441_ID_STATE, 10, stateData, 4);
 }
 
+// Reads the Design Energy of the connected battery.
+uint16_t BQ27441::designEnergy(void)
+{
+	uint8_t energyData[2];
+	readExtendedData(BQ27441_ID_STATE, 12, energyData, 2);
+	return ((uint16_t)energyData[0] << 8) | energyData[1];
+}
+
 // Configures the Taper Rate of the connected battery (0~2000).
 bool BQ27441::setTaperRate(uint16_t taperRate)
 {
@@ -88,6 +138,14 @@ bool BQ27441::setTaperRate(uint16_t taperRate)
 	return writeExtendedData(BQ27441_ID_STATE, 27, stateData, 2);
 }
 
+// Reads the Taper Rate of the connected battery.
+uint16_t BQ27441::taperRate(void)
+{
+	uint8_t rateData[2];
+	readExtendedData(BQ27441_ID_STATE, 27, rateData, 2);
+	return ((uint16_t)rateData[0] << 8) | rateData[1];
+}
+
 // Set the Terminate Voltage of the connected battery (2500mV~3700mV).
 bool BQ27441::setTerminateVoltage(uint16_t voltage)
 {
@@ -101,6 +159,14 @@ bool BQ27441::setTerminateVoltage(uint16_t voltage)
 	return writeExtendedData(BQ27441_ID_STATE, 16, stateData, 2);
 }
 
+// Reads the Terminate Voltage of the connected battery.
+uint16_t BQ27441::terminateVoltage(void)
+{
+	uint8_t voltData[2];
+	readExtendedData(BQ27441_ID_STATE, 16, voltData, 2);
+	return ((uint16_t)voltData[0] << 8) | voltData[1];
+}
+
 // Set the Update Status Register of the battery fuel gauge.
 bool BQ27441::setUpdateStatusReg(uint8_t status)
 {
@@ -158,7 +224,7 @@ bool BQ27441::setRaTable(uint16_t * ra)
 // Reads and returns the battery voltage
 uint16_t BQ27441::voltage(void)
 {
-	return readWord(BQ27441_COMMAND_VOLTAGE);
+	return read<BQ27441Reg::Voltage>();
 }
 
 // Reads and returns the specified current measurement
@@ -168,13 +234,13 @@ int16_t BQ27441::current(current_measure type)
 	switch (type)
 	{
 	case AVG:
-		current = (int16_t) readWord(BQ27441_COMMAND_AVG_CURRENT);
+		current = read<BQ27441Reg::AverageCurrent>();
 		break;
 	case STBY:
-		current = (int16_t) readWord(BQ27441_COMMAND_STDBY_CURRENT);
+		current = read<BQ27441Reg::StandbyCurrent>();
 		break;
 	case MAX:
-		current = (int16_t) readWord(BQ27441_COMMAND_MAX_CURRENT);
+		current = read<BQ27441Reg::MaxLoadCurrent>();
 		break;
 	}
 	
@@ -188,31 +254,31 @@ uint16_t BQ27441::capacity(capacity_measure type)
 	switch (type)
 	{
 	case REMAIN:
-		return readWord(BQ27441_COMMAND_REM_CAPACITY);
+		return read<BQ27441Reg::RemCapacity>();
 		break;
 	case FULL:
-		return readWord(BQ27441_COMMAND_FULL_CAPACITY);
+		return read<BQ27441Reg::FullCapacity>();
 		break;
 	case AVAIL:
-		capacity = readWord(BQ27441_COMMAND_NOM_CAPACITY);
+		capacity = read<BQ27441Reg::NomAvailCapacity>();
 		break;
 	case AVAIL_FULL:
-		capacity = readWord(BQ27441_COMMAND_AVAIL_CAPACITY);
+		capacity = read<BQ27441Reg::FullAvailCapacity>();
 		break;
 	case REMAIN_F: 
-		capacity = readWord(BQ27441_COMMAND_REM_CAP_FIL);
+		capacity = read<BQ27441Reg::RemCapFil>();
 		break;
 	case REMAIN_UF:
-		capacity = readWord(BQ27441_COMMAND_REM_CAP_UNFL);
+		capacity = read<BQ27441Reg::RemCapUnfl>();
 		break;
 	case FULL_F:
-		capacity = readWord(BQ27441_COMMAND_FULL_CAP_FIL);
+		capacity = read<BQ27441Reg::FullCapFil>();
 		break;
 	case FULL_UF:
-		capacity = readWord(BQ27441_COMMAND_FULL_CAP_UNFL);
+		capacity = read<BQ27441Reg::FullCapUnfl>();
 		break;
 	case DESIGN:
-		capacity = readWord(BQ27441_EXTENDED_CAPACITY);
+		capacity = read<BQ27441Reg::DesignCapacity>();
 	}
 	
 	return capacity;
@@ -221,7 +287,7 @@ uint16_t BQ27441::capacity(capacity_measure type)
 // Reads and returns measured average power
 int16_t BQ27441::power(void)
 {
-	return (int16_t) readWord(BQ27441_COMMAND_AVG_POWER);
+	return read<BQ27441Reg::AveragePower>();
 }
 
 // Reads and returns specified state of charge measurement
@@ -231,10 +297,10 @@ uint16_t BQ27441::soc(soc_measure type)
 	switch (type)
 	{
 	case FILTERED:
-		socRet = readWord(BQ27441_COMMAND_SOC);
+		socRet = read<BQ27441Reg::StateOfCharge>();
 		break;
 	case UNFILTERED:
-		socRet = readWord(BQ27441_COMMAND_SOC_UNFL);
+		socRet = read<BQ27441Reg::StateOfChargeUnfl>();
 		break;
 	}
 	
@@ -244,14 +310,11 @@ uint16_t BQ27441::soc(soc_measure type)
 // Reads and returns specified state of health measurement
 uint8_t BQ27441::soh(soh_measure type)
 {
-	uint16_t sohRaw = readWord(BQ27441_COMMAND_SOH);
-	uint8_t sohStatus = sohRaw >> 8;
-	uint8_t sohPercent = sohRaw & 0x00FF;
-	
+	// Percentage and status are separate bytes, read just the one asked for
 	if (type == PERCENT)	
-		return sohPercent;
+		return read<BQ27441Reg::SohPercent>();
 	else
-		return sohStatus;
+		return read<BQ27441Reg::SohStatus>();
 }
 
 // Reads and returns specified temperature measurement
@@ -261,15 +324,53 @@ uint16_t BQ27441::temperature(temp_measure type)
 	switch (type)
 	{
 	case BATTERY:
-		temp = readWord(BQ27441_COMMAND_TEMP);
+		temp = read<BQ27441Reg::Temperature>();
 		break;
 	case INTERNAL_TEMP:
-		temp = readWord(BQ27441_COMMAND_INT_TEMP);
+		temp = read<BQ27441Reg::InternalTemp>();
 		break;
 	}
 	return temp;
 }
 
+// Standard commands are little-endian words, indexed from Temperature()
+static uint16_t snapshotWord(const uint8_t * data, uint8_t command)
+{
+	uint8_t i = command - BQ27441_COMMAND_TEMP;
+	return ((uint16_t)data[i + 1] << 8) | data[i];
+}
+
+// Reads the standard command window (0x02~0x31) and decodes it into a snapshot
+bool BQ27441::snapshot(bq27441_snapshot & snap)
+{
+	uint8_t data[BQ27441_COMMAND_SOC_UNFL + 2 - BQ27441_COMMAND_TEMP];
+	if (!i2cReadBlock(BQ27441_COMMAND_TEMP, data, sizeof(data)))
+		return false;
+	
+	snap.temperature       = snapshotWord(data, BQ27441_COMMAND_TEMP);
+	snap.voltage           = snapshotWord(data, BQ27441_COMMAND_VOLTAGE);
+	snap.flags             = snapshotWord(data, BQ27441_COMMAND_FLAGS);
+	snap.nomAvailCapacity  = snapshotWord(data, BQ27441_COMMAND_NOM_CAPACITY);
+	snap.fullAvailCapacity = snapshotWord(data, BQ27441_COMMAND_AVAIL_CAPACITY);
+	snap.remCapacity       = snapshotWord(data, BQ27441_COMMAND_REM_CAPACITY);
+	snap.fullCapacity      = snapshotWord(data, BQ27441_COMMAND_FULL_CAPACITY);
+	snap.avgCurrent        = (int16_t) snapshotWord(data, BQ27441_COMMAND_AVG_CURRENT);
+	snap.stbyCurrent       = (int16_t) snapshotWord(data, BQ27441_COMMAND_STDBY_CURRENT);
+	snap.maxCurrent        = (int16_t) snapshotWord(data, BQ27441_COMMAND_MAX_CURRENT);
+	snap.avgPower          = (int16_t) snapshotWord(data, BQ27441_COMMAND_AVG_POWER);
+	snap.soc               = snapshotWord(data, BQ27441_COMMAND_SOC);
+	snap.intTemperature    = snapshotWord(data, BQ27441_COMMAND_INT_TEMP);
+	snap.sohPercent        = snapshotWord(data, BQ27441_COMMAND_SOH) & 0x00FF;
+	snap.sohStatus         = snapshotWord(data, BQ27441_COMMAND_SOH) >> 8;
+	snap.remCapUnfl        = snapshotWord(data, BQ27441_COMMAND_REM_CAP_UNFL);
+	snap.remCapFil         = snapshotWord(data, BQ27441_COMMAND_REM_CAP_FIL);
+	snap.fullCapUnfl       = snapshotWord(data, BQ27441_COMMAND_FULL_CAP_UNFL);
+	snap.fullCapFil        = snapshotWord(data, BQ27441_COMMAND_FULL_CAP_FIL);
+	snap.socUnfl           = snapshotWord(data, BQ27441_COMMAND_SOC_UNFL);
+	
+	return true;
+}
+
 /*****************************************************************************
  ************************** GPOUT Control Functions **************************
  *****************************************************************************/
@@ -427,33 +528,59 @@ uint16_t BQ27441::deviceType(void)
 	return readControlWord(BQ27441_CONTROL_DEVICE_TYPE);
 }
 
+// Read the Data Memory code - identifies the Data Memory layout
+uint16_t BQ27441::dmCode(void)
+{
+	return readControlWord(BQ27441_CONTROL_DM_CODE);
+}
+
 // Enter configuration mode - set userControl if calling from an Arduino sketch
 // and you want control over when to exitConfig
 bool BQ27441::enterConfig(bool userControl)
+{
+	if (!beginEnterConfig(userControl))
+		return false;
+	
+	return waitPoll();
+}
+
+// Exit configuration mode with the option to perform a resimulation
+bool BQ27441::exitConfig(bool resim)
+{
+	if (!beginExitConfig(resim))
+		return false;
+	
+	return waitPoll();
+}
+
+// Start entering configuration mode, poll() completes when CFGUPMODE is set
+bool BQ27441::beginEnterConfig(bool userControl)
 {
 	if (userControl) _userConfigControl = true;
+	_blockValid = false; // Data memory may have been updated since the last visit
+	_pollOp = BQ27441_POLL_NONE;
 	
 	if (sealed())
 	{
 		_sealFlag = true;
-		unseal(); // Must be unsealed before making changes
+		if (!unseal()) // Must be unsealed before making changes
+			return false;
 	}
-	
-	if (executeControlWord(BQ27441_CONTROL_SET_CFGUPDATE))
+	else if (_transferError != BQ27441_OK)
 	{
-		int16_t timeout = BQ72441_I2C_TIMEOUT;
-		while ((timeout--) && (!(status() & BQ27441_FLAG_CFGUPMODE)))
-			delay(1);
-		
-		if (timeout > 0)
-			return true;
+		return false;
 	}
 	
-	return false;
+	if (!executeControlWord(BQ27441_CONTROL_SET_CFGUPDATE))
+		return false;
+	
+	_pollOp = BQ27441_POLL_ENTER_CONFIG;
+	_pollStart = millis();
+	return true;
 }
 
-// Exit configuration mode with the option to perform a resimulation
-bool BQ27441::exitConfig(bool resim)
+// Start exiting configuration mode, poll() completes when CFGUPMODE is cleared
+bool BQ27441::beginExitConfig(bool resim)
 {
 	// There are two methods for exiting config mode:
 	//    1. Execute the EXIT_CFGUPDATE command
@@ -462,31 +589,79 @@ bool BQ27441::exitConfig(bool resim)
 	// measurement, and without resimulating to update unfiltered-SoC and SoC.
 	// If a new OCV measurement or resimulation is desired, SOFT_RESET or
 	// EXIT_RESIM should be used to exit config mode.
+	_blockValid = false;
+	_userConfigControl = false;
+	_pollOp = BQ27441_POLL_NONE;
 	if (resim)
 	{
-		if (softReset())
-		{
-			int16_t timeout = BQ72441_I2C_TIMEOUT;
-			while ((timeout--) && ((flags() & BQ27441_FLAG_CFGUPMODE)))
-				delay(1);
-			if (timeout > 0)
-			{
-				if (_sealFlag) seal(); // Seal back up if we IC was sealed coming in
-				return true;
-			}
-		}
-		return false;
+		if (!softReset())
+			return false;
+		_pollOp = BQ27441_POLL_EXIT_CONFIG;
+		_pollStart = millis();
+		return true;
 	}
 	else
 	{
-		return executeControlWord(BQ27441_CONTROL_EXIT_CFGUPDATE);
+		if (!executeControlWord(BQ27441_CONTROL_EXIT_CFGUPDATE))
+			return false;
+		if (_sealFlag) seal(); // Seal back up if we IC was sealed coming in
+		return true;
 	}	
 }
 
+// Start waiting for INITCOMP after a power-on reset
+bool BQ27441::beginWaitInit(void)
+{
+	_pollOp = BQ27441_POLL_INIT;
+	_pollStart = millis();
+	return true;
+}
+
+// Advance the pending operation, one register read per call
+poll_result BQ27441::poll(void)
+{
+	bool done = false;
+	switch (_pollOp)
+	{
+	case BQ27441_POLL_ENTER_CONFIG:
+		// CFGUPMODE is reported in Flags(), bit 4 of CONTROL_STATUS is SLEEP
+		done = flags() & BQ27441_FLAG_CFGUPMODE;
+		break;
+	case BQ27441_POLL_EXIT_CONFIG:
+		done = !(flags() & BQ27441_FLAG_CFGUPMODE);
+		if (_transferError != BQ27441_OK)
+			break; // A failed read isn't an exit, and seal() would hide the error
+		if (done && _sealFlag) seal(); // Seal back up if we IC was sealed coming in
+		break;
+	case BQ27441_POLL_INIT:
+		done = status() & BQ27441_STATUS_INITCOMP;
+		break;
+	default:
+		return POLL_DONE;
+	}
+	
+	if (_transferError != BQ27441_OK)
+	{
+		_pollOp = BQ27441_POLL_NONE;
+		return POLL_ERROR; // Don't wait out the timeout on a broken bus
+	}
+	if (done)
+	{
+		_pollOp = BQ27441_POLL_NONE;
+		return POLL_DONE;
+	}
+	if (millis() - _pollStart > BQ72441_I2C_TIMEOUT)
+	{
+		_pollOp = BQ27441_POLL_NONE;
+		return POLL_ERROR;
+	}
+	return POLL_PENDING;
+}
+
 // Read the flags() command
 uint16_t BQ27441::flags(void)
 {
-	return readWord(BQ27441_COMMAND_FLAGS);
+	return read<BQ27441Reg::Flags>();
 }
 
 // Read the CONTROL_STATUS subcommand of control()
@@ -495,8 +670,60 @@ uint16_t BQ27441::status(void)
 	return readControlWord(BQ27441_CONTROL_STATUS);
 }
 
+// Start staging Data Memory writes
+void BQ27441::beginStagedWrites(void)
+{
+	_staging = true;
+	_stageSuccess = true;
+}
+
+// Commit the staged block and stop staging
+bool BQ27441::commitStagedWrites(void)
+{
+	bool success = commitBlock() && _stageSuccess;
+	_staging = false;
+	_stageSuccess = true;
+	return success;
+}
+
+// Enter config mode unless the sketch already has it
+BQ27441::ConfigSession::ConfigSession(BQ27441 & lipo, bool resim) : 
+	_lipo(lipo), _owner(false), _active(true), _resim(resim)
+{
+	if (_lipo._userConfigControl)
+		return;
+	_owner = _active = _lipo.enterConfig(true);
+	if (!_owner)
+		_lipo._userConfigControl = false; // Nothing to exit, give control back
+}
+
+// Exit config mode when the session goes out of scope
+BQ27441::ConfigSession::~ConfigSession()
+{
+	exit();
+}
+
+// Exit config mode now, only once and only if this session entered it
+bool BQ27441::ConfigSession::exit(void)
+{
+	if (!_owner)
+		return true;
+	_owner = false;
+	_active = false;
+	return _lipo.exitConfig(_resim);
+}
+
 /***************************** Private Functions *****************************/
 
+// Call poll() until the pending operation completes
+bool BQ27441::waitPoll(void)
+{
+	poll_result result;
+	while ((result = poll()) == POLL_PENDING)
+		delay(1);
+	return (result == POLL_DONE);
+}
+
 // Check if the BQ27441-G1A is sealed or not.
 bool BQ27441::sealed(void)
 {
@@ -507,7 +734,7 @@ bool BQ27441::sealed(void)
 // Seal the BQ27441-G1A
 bool BQ27441::seal(void)
 {
-	return readControlWord(BQ27441_CONTROL_SEALED);
+	return executeControlWord(BQ27441_CONTROL_SEALED);
 }
 
 // UNseal the BQ27441-G1A
@@ -515,9 +742,9 @@ bool BQ27441::unseal(void)
 {
 	// To unseal the BQ27441, write the key to the control
 	// command. Then immediately write the same key to control again.
-	if (readControlWord(BQ27441_UNSEAL_KEY))
+	if (executeControlWord(BQ27441_UNSEAL_KEY))
 	{
-		return readControlWord(BQ27441_UNSEAL_KEY);
+		return executeControlWord(BQ27441_UNSEAL_KEY);
 	}
 	return false;
 }
@@ -525,7 +752,7 @@ bool BQ27441::unseal(void)
 // Read the 16-bit opConfig register from extended data
 uint16_t BQ27441::opConfig(void)
 {
-	return readWord(BQ27441_EXTENDED_OPCONFIG);
+	return read<BQ27441Reg::OpConfig>();
 }
 
 // Write the 16-bit opConfig register in extended data
@@ -551,14 +778,6 @@ bool BQ27441::exitResim(void)
 	return executeControlWord(BQ27441_CONTROL_EXIT_RESIM);
 }
 
-// Read a 16-bit command word from the BQ27441-G1A
-uint16_t BQ27441::readWord(uint16_t subAddress)
-{
-	uint8_t data[2];
-	i2cReadBytes(subAddress, data, 2);
-	return ((uint16_t)data[1] << 8) | data[0];
-}
-
 // Read a 16-bit subcommand() from the BQ27441-G1A's control()
 uint16_t BQ27441::readControlWord(uint16_t function)
 {
@@ -567,14 +786,15 @@ uint16_t BQ27441::readControlWord(uint16_t function)
 	uint8_t command[2] = {subCommandLSB, subCommandMSB};
 	uint8_t data[2] = {0, 0};
 	
-	i2cWriteBytes((uint8_t) 0, command, 2);
+	if (i2cWriteBytes((uint8_t) 0, command, 2) != BQ27441_OK)
+		return 0;
 	
-	if (i2cReadBytes((uint8_t) 0, data, 2))
+	if (i2cReadBytes((uint8_t) 0, data, 2) == BQ27441_OK)
 	{
 		return ((uint16_t)data[1] << 8) | data[0];
 	}
 	
-	return false;
+	return 0;
 }
 
 // Execute a subcommand() from the BQ27441-G1A's control()
@@ -583,12 +803,8 @@ bool BQ27441::executeControlWord(uint16_t function)
 	uint8_t subCommandMSB = (function >> 8);
 	uint8_t subCommandLSB = (function & 0x00FF);
 	uint8_t command[2] = {subCommandLSB, subCommandMSB};
-	uint8_t data[2] = {0, 0};
-	
-	if (i2cWriteBytes((uint8_t) 0, command, 2))
-		return true;
 	
-	return false;
+	return (i2cWriteBytes((uint8_t) 0, command, 2) == BQ27441_OK);
 }
 
 /*****************************************************************************
@@ -599,56 +815,141 @@ bool BQ27441::executeControlWord(uint16_t function)
 bool BQ27441::blockDataControl(void)
 {
 	uint8_t enableByte = 0x00;
-	return i2cWriteBytes(BQ27441_EXTENDED_CONTROL, &enableByte, 1);
+	return (i2cWriteBytes(BQ27441_EXTENDED_CONTROL, &enableByte, 1) == BQ27441_OK);
 }
 
 // Issue a DataClass() command to set the data class to be accessed
 bool BQ27441::blockDataClass(uint8_t id)
 {
-	return i2cWriteBytes(BQ27441_EXTENDED_DATACLASS, &id, 1);
+	_blockValid = false;
+	_blockClass = id;
+	_blockIndex = 0; // Selecting a class always starts at block 0
+	return (i2cWriteBytes(BQ27441_EXTENDED_DATACLASS, &id, 1) == BQ27441_OK);
 }
 
 // Issue a DataBlock() command to set the data block to be accessed
 bool BQ27441::blockDataOffset(uint8_t offset)
 {
-	return i2cWriteBytes(BQ27441_EXTENDED_DATABLOCK, &offset, 1);
+	_blockValid = false;
+	_blockIndex = offset;
+	return (i2cWriteBytes(BQ27441_EXTENDED_DATABLOCK, &offset, 1) == BQ27441_OK);
+}
+
+// Select a class and block for BlockData() access and load it into the block buffer
+bool BQ27441::selectBlock(uint8_t classID, uint8_t block)
+{
+	if (_blockValid && (_blockClass == classID) && (_blockIndex == block))
+		return true; // Already buffered, no bus traffic needed
+	
+	if (!blockDataControl()) // // enable block data memory control
+		return false; // Return false if enable fails
+	if (!blockDataClass(classID)) // Write class ID using DataBlockClass()
+		return false;
+	
+	if (!blockDataOffset(block)) // Write 32-bit block offset (usually 0)
+		return false;
+	
+	return readBlock();
+}
+
+// Read all 32 bytes of BlockData() into the block buffer in one burst
+bool BQ27441::readBlock(void)
+{
+	_blockValid = (i2cReadBytes(BQ27441_EXTENDED_BLOCKDATA, _blockData, 32) == BQ27441_OK);
+	return _blockValid;
 }
 
 // Read the current checksum using BlockDataCheckSum()
 uint8_t BQ27441::blockDataChecksum(void)
 {
 	uint8_t csum;
-	i2cReadBytes(BQ27441_EXTENDED_CHECKSUM, &csum, 1);
+	i2cReadBytes(BQ27441_EXTENDED_CHECKSUM, &csum, 1); // Zero-filled on error
 	return csum;
 }
 
-// Use BlockData() to read a byte from the loaded extended data
+// Read a byte of the loaded extended data from the block buffer
 uint8_t BQ27441::readBlockData(uint8_t offset)
 {
-	uint8_t ret;
-	uint8_t address = offset + BQ27441_EXTENDED_BLOCKDATA;
-	i2cReadBytes(address, &ret, 1);
-	return ret;
+	if (!_blockValid) readBlock();
+	return _blockData[offset % 32];
 }
 
-// Use BlockData() to write a byte to an offset of the loaded data
-bool BQ27441::writeBlockData(uint8_t offset, uint8_t data)
+// Use BlockData() to write a run of bytes to an offset of the loaded data
+bool BQ27441::writeBlockData(uint8_t offset, uint8_t * data, uint8_t len)
 {
 	uint8_t address = offset + BQ27441_EXTENDED_BLOCKDATA;
-	return i2cWriteBytes(address, &data, 1);
+	for (uint8_t i = 0; i < len; i++)
+		_blockData[(offset + i) % 32] = data[i]; // Keep the buffer in step with the IC
+	return (i2cWriteBytes(address, data, len) == BQ27441_OK);
 }
 
-// Read all 32 bytes of the loaded extended data and compute a 
-// checksum based on the values.
+// Load a block into the staging shadow, committing the pending block first
+bool BQ27441::stageBlock(uint8_t classID, uint8_t block)
+{
+	if (_stagePending && (_blockClass == classID) && (_blockIndex == block))
+		return true; // Keep editing the pending block
+	
+	if (!commitBlock()) // Moving to another block
+		_stageSuccess = false;
+	if (!selectBlock(classID, block))
+		return false;
+	
+	memcpy(_stagedData, _blockData, 32);
+	_stagePending = true;
+	return true;
+}
+
+// Commit the staged block: changed bytes first, then the new checksum
+bool BQ27441::commitBlock(void)
+{
+	if (!_stagePending)
+		return true;
+	_stagePending = false;
+	
+	if (!selectBlock(_blockClass, _blockIndex)) // Reload if the buffer was dropped
+		return false;
+	
+	// Write each run of changed bytes in one burst. Runs separated by a gap of 
+	// one or two unchanged bytes are merged, as that is cheaper than a new 
+	// transaction. A burst carries the sub-address, so it holds at most 31 bytes.
+	bool success = true;
+	bool changed = false;
+	uint8_t i = 0;
+	while (i < 32)
+	{
+		if (_stagedData[i] == _blockData[i])
+		{
+			i++;
+			continue;
+		}
+		uint8_t start = i;
+		uint8_t end = i + 1;
+		for (uint8_t j = end; (j < 32) && (j < end + 3) && (j - start < BQ27441_I2C_BUFFER - 1); j++)
+		{
+			if (_stagedData[j] != _blockData[j])
+				end = j + 1;
+		}
+		success = writeBlockData(start, &_stagedData[start], end - start) && success;
+		changed = true;
+		i = end;
+	}
+	
+	if (!changed)
+		return true; // Data memory already holds these values
+	
+	// Write new checksum using BlockDataChecksum (0x60)
+	return writeBlockChecksum(computeBlockChecksum()) && success;
+}
+
+// Compute a checksum based on all 32 bytes of the loaded extended data
 uint8_t BQ27441::computeBlockChecksum(void)
 {
-	uint8_t data[32];
-	i2cReadBytes(BQ27441_EXTENDED_BLOCKDATA, data, 32);
+	if (!_blockValid) readBlock();
 
 	uint8_t csum = 0;
 	for (int i=0; i<32; i++)
 	{
-		csum += data[i];
+		csum += _blockData[i];
 	}
 	csum = 255 - csum;
 	
@@ -658,66 +959,68 @@ uint8_t BQ27441::computeBlockChecksum(void)
 // Use the BlockDataCheckSum() command to write a checksum value
 bool BQ27441::writeBlockChecksum(uint8_t csum)
 {
-	return i2cWriteBytes(BQ27441_EXTENDED_CHECKSUM, &csum, 1);	
+	_blockValid = false; // IC reloads the block from data memory, re-read on next access
+	return (i2cWriteBytes(BQ27441_EXTENDED_CHECKSUM, &csum, 1) == BQ27441_OK);
 }
 
 // Read a specified number of bytes from extended data specifying a class ID and position offset
 bool BQ27441::readExtendedData(uint8_t classID, uint8_t offset, uint8_t * data, uint8_t len)
 {
-	if (!_userConfigControl) enterConfig(false);
-		
-	if (!blockDataControl()) // // enable block data memory control
-		return false; // Return false if enable fails
-	if (!blockDataClass(classID)) // Write class ID using DataBlockClass()
+	if (!_userConfigControl && !_staging && !enterConfig(false))
 		return false;
 	
-	blockDataOffset(offset / 32); // Write 32-bit block offset (usually 0)
-	
-	computeBlockChecksum(); // Compute checksum going in
-	uint8_t oldCsum = blockDataChecksum();
-	/*for (uint8_t i = 0; i < 32; i++)
-		Serial.print(String(readBlockData(i)) + " “);*/
-	for (uint8_t i = 0; i < len; i++)
-		data[i] = readBlockData((offset+i) % 32); // Read from offset (limit to 0-31)
+	bool success = true;
+	if (_stagePending && (_blockClass == classID) && (_blockIndex == offset / 32))
+	{
+		// Staged edits of this block are read back from the shadow
+		for (uint8_t i = 0; i < len; i++)
+			data[i] = _stagedData[(offset+i) % 32];
+	}
+	else
+	{
+		// Any other block commits the staged edits first
+		if (_stagePending && !commitBlock())
+			_stageSuccess = false;
+		
+		// Load the whole 32-byte block in one burst, then serve the bytes from the buffer
+		success = selectBlock(classID, offset / 32);
+		for (uint8_t i = 0; success && (i < len); i++)
+			data[i] = readBlockData((offset+i) % 32); // Read from offset (limit to 0-31)
+	}
 	
-	if (!_userConfigControl) exitConfig();
+	if (!_userConfigControl && !_staging) exitConfig();
 	
-	return true;
+	return success;
 }
 
 // Write a specified number of bytes to extended data specifying a 
 // class ID, position offset.
 bool BQ27441::writeExtendedData(uint8_t classID, uint8_t offset, uint8_t * data, uint8_t len)
 {
-	if (len > 32)
+	if ((offset % 32) + len > 32) // Must fit in the 32-byte block
 		return false;
 	
-	if (!_userConfigControl) enterConfig(false);
-	
-	if (!blockDataControl()) // // enable block data memory control
-		return false; // Return false if enable fails
-	if (!blockDataClass(classID)) // Write class ID using DataBlockClass()
+	if (!_userConfigControl && !_staging && !enterConfig(false))
 		return false;
 	
-	blockDataOffset(offset / 32); // Write 32-bit block offset (usually 0)
-	computeBlockChecksum(); // Compute checksum going in
-	uint8_t oldCsum = blockDataChecksum();
-
-	// Write data bytes:
-	for (int i = 0; i < len; i++)
+	bool success = stageBlock(classID, offset / 32); // Load the block going in
+	if (success)
 	{
-		// Write to offset, mod 32 if offset is greater than 32
-		// The blockDataOffset above sets the 32-bit block
-		writeBlockData((offset % 32) + i, data[i]);
+		// Apply the data bytes to the shadow block
+		// The offset is mod 32, stageBlock above selects the 32-bit block
+		memcpy(&_stagedData[offset % 32], data, len);
+		
+		if (!_staging)
+			success = commitBlock();
+	}
+	else if (_staging)
+	{
+		_stageSuccess = false;
 	}
-	
-	// Write new checksum using BlockDataChecksum (0x60)
-	uint8_t newCsum = computeBlockChecksum(); // Compute the new checksum
-	writeBlockChecksum(newCsum);
 
-	if (!_userConfigControl) exitConfig();
+	if (!_userConfigControl && !_staging) exitConfig();
 	
-	return true;
+	return success;
 }
 
 /*****************************************************************************
@@ -725,39 +1028,129 @@ bool BQ27441::writeExtendedData(uint8_t classID, uint8_t offset, uint8_t * data,
  *****************************************************************************/
 
 // Read a specified number of bytes over I2C at a given subAddress
-int16_t BQ27441::i2cReadBytes(uint8_t subAddress, uint8_t * dest, uint8_t count)
+bq27441_error BQ27441::i2cReadBytes(uint8_t subAddress, uint8_t * dest, uint8_t count)
 {
-	int16_t timeout = BQ72441_I2C_TIMEOUT;	
-	Wire.beginTransmission(_deviceAddress);
-	Wire.write(subAddress);
-	Wire.endTransmission(true);
+	unsigned long start = micros();
+	unsigned long waitStart = start;
+	bq27441_error error = selectChannel();
+	if (error == BQ27441_OK)
+	{
+		_i2cPort->beginTransmission(_deviceAddress);
+		_i2cPort->write(subAddress);
+		error = wireError(_i2cPort->endTransmission(true));
+	}
 	
-	Wire.requestFrom(_deviceAddress, count);
-	while ((Wire.available() < count) && timeout--)
-		delay(1);
-	if (timeout)
+	if (error == BQ27441_OK)
 	{
-		for (int i=0; i<count; i++)
+		_i2cPort->requestFrom(_deviceAddress, count);
+		waitStart = micros();
+		while (_i2cPort->available() < count)
 		{
-			dest[i] = Wire.read();
+			if (micros() - start >= _timeoutMicros)
+			{
+				error = BQ27441_ERR_TIMEOUT;
+				break;
+			}
+			yield();
 		}
 	}
 	
-	return timeout;
+	if (_busStats && (error != BQ27441_ERR_MUX))
+	{
+		bq27441_bus_counter * counter = busCounter(subAddress);
+		bool requested = (error == BQ27441_OK) || (error == BQ27441_ERR_TIMEOUT);
+		counter->transactions += requested ? 2 : 1;
+		counter->bytes += requested ? 1 + count : 1;
+		counter->waitMicros += micros() - waitStart;
+		if (error == BQ27441_ERR_TIMEOUT) counter->timeouts++;
+	}
+	
+	for (int i=0; i<count; i++)
+	{
+		dest[i] = (error == BQ27441_OK) ? _i2cPort->read() : 0;
+	}
+	
+	return transferResult(error);
+}
+
+// Read a run of consecutive registers, split into bursts that fit in the Wire buffer
+bool BQ27441::i2cReadBlock(uint8_t subAddress, uint8_t * dest, uint8_t count)
+{
+	while (count > 0)
+	{
+		uint8_t burst = (count > BQ27441_I2C_BUFFER) ? BQ27441_I2C_BUFFER : count;
+		if (i2cReadBytes(subAddress, dest, burst) != BQ27441_OK)
+			return false;
+		subAddress += burst;
+		dest += burst;
+		count -= burst;
+	}
+	return true;
 }
 
 // Write a specified number of bytes over I2C to a given subAddress
-uint16_t BQ27441::i2cWriteBytes(uint8_t subAddress, uint8_t * src, uint8_t count)
+bq27441_error BQ27441::i2cWriteBytes(uint8_t subAddress, uint8_t * src, uint8_t count)
 {
-	Wire.beginTransmission(_deviceAddress);
-	Wire.write(subAddress);
+	bq27441_error error = selectChannel();
+	if (error != BQ27441_OK)
+		return transferResult(error);
+	
+	_i2cPort->beginTransmission(_deviceAddress);
+	_i2cPort->write(subAddress);
 	for (int i=0; i<count; i++)
 	{
-		Wire.write(src[i]);
+		_i2cPort->write(src[i]);
 	}	
-	Wire.endTransmission(true);
+	error = wireError(_i2cPort->endTransmission(true));
+	
+	if (_busStats)
+	{
+		bq27441_bus_counter * counter = busCounter(subAddress);
+		counter->transactions++;
+		counter->bytes += 1 + count;
+	}
 	
-	return true;	
+	return transferResult(error);
+}
+
+// Translate a Wire.endTransmission() status into an error code
+bq27441_error BQ27441::wireError(uint8_t status)
+{
+	switch (status)
+	{
+	case 0:  return BQ27441_OK;
+	case 1:  return BQ27441_ERR_LENGTH;
+	case 2:  return BQ27441_ERR_NACK_ADDR;
+	case 3:  return BQ27441_ERR_NACK_DATA;
+	default: return BQ27441_ERR_BUS;
+	}
+}
+
+// Connect the BQ27441-G1A to the bus, if it is behind a mux
+bq27441_error BQ27441::selectChannel(void)
+{
+	if (_mux && (_mux->select(_muxChannel) != 0))
+		return BQ27441_ERR_MUX;
+	return BQ27441_OK;
+}
+
+// Record the result of a transfer for lastError() and poll()
+bq27441_error BQ27441::transferResult(bq27441_error error)
+{
+	_transferError = error;
+	if (error != BQ27441_OK)
+		_lastError = error;
+	return error;
+}
+
+// Select the profileBus() counter for transactions at a given subAddress
+bq27441_bus_counter * BQ27441::busCounter(uint8_t subAddress)
+{
+	if (subAddress <= 0x01)
+		return &_busStats->control;
+	if ((subAddress >= BQ27441_EXTENDED_DATACLASS) && (subAddress <= BQ27441_EXTENDED_CONTROL))
+		return &_busStats->block;
+	return &_busStats->standard;
 }
 
 // BQ27441 lipo; // Use lipo.[] to interact with the library in an Arduino sketch
\ No newline at end of file
@@ -17,6 +17,23 @@ Modified by D. Chao:
 - Added Qmax() and setQmax() - To improve initial accuracy of battery fuel gauge.
 - Added RaTable() and setRaTable() - To read and set the R_a RAM Table.
 - Changed readExtendedData() parameters to read a block of data instead of a byte.
+- Added snapshot() - To read the whole standard command window in one I2C burst.
+- Changed readExtendedData() to read the 32-byte BlockData() window in one burst and 
+  serve it from a block buffer.
+- Added ConfigSession - To share one config mode entry among many Data Memory accesses.
+- Added beginStagedWrites() and commitStagedWrites() - To coalesce Data Memory writes,
+  one load and one diff-only commit per block.
+- Added beginEnterConfig(), beginExitConfig(), beginWaitInit() and poll() - To wait for
+  mode changes without blocking.
+- Added profileBus() - To count I2C transactions, bytes and wait time per command group.
+- Changed the I2C routines to return bq27441_error codes and to give up on a read after
+  a microsecond deadline (setI2CTimeout()). Errors are reported by lastError().
+- Added read<>() and the typed register map (BQ27441_Registers.h) - To read registers,
+  or a group of them in one burst, with the transfer worked out at compile time.
+- Added designEnergy(), taperRate(), terminateVoltage() and dmCode() - To read back the
+  battery configuration.
+- Added begin(wirePort) and begin(mux, channel) - To use another I2C bus, or one channel
+  of a TCA9548A mux (BQ27441_Mux.h) so more than one gauge can share a bus.
 
 
 Hardware Resources:
@@ -34,8 +51,12 @@ Arduino Uno (any 'duino should do)
 
 #include "Arduino.h"
 #include "BQ27441_Definitions.h"
+#include "BQ27441_Registers.h"
+#include "BQ27441_Mux.h"
 
-#define BQ72441_I2C_TIMEOUT 2000
+#define BQ72441_I2C_TIMEOUT 2000 // Longest wait (ms) for a mode change in poll()
+#define BQ27441_I2C_DEADLINE 10000 // Default longest time (us) for one I2C read, see setI2CTimeout()
+#define BQ27441_I2C_BUFFER  32   // Wire library buffer size, longest single I2C burst
 
 // Parameters for the current() function, to specify which current to read
 typedef enum {
@@ -81,6 +102,63 @@ typedef enum {
 	BAT_LOW  // Set GPOUT to BAT_LOW functionality
 } gpout_function;
 
+// Return values of the poll() function
+typedef enum {
+	POLL_PENDING, // Operation in progress, call poll() again
+	POLL_DONE,    // Operation completed (or nothing to do)
+	POLL_ERROR    // Operation failed or timed out
+} poll_result;
+
+// Error codes of the I2C transfers, see lastError()
+typedef enum {
+	BQ27441_OK,            // No error
+	BQ27441_ERR_LENGTH,    // Transfer doesn't fit in the Wire buffer
+	BQ27441_ERR_NACK_ADDR, // Address not acknowledged (IC missing or unpowered)
+	BQ27441_ERR_NACK_DATA, // Data byte not acknowledged
+	BQ27441_ERR_BUS,       // Other bus error reported by Wire
+	BQ27441_ERR_TIMEOUT,   // Read data didn't arrive before the deadline
+	BQ27441_ERR_MUX        // Mux channel couldn't be selected
+} bq27441_error;
+
+// Standard command window read by the snapshot() function (0x02 ~ 0x31)
+typedef struct {
+	uint16_t temperature;       // Temperature() (0.1K)
+	uint16_t voltage;           // Voltage() (mV)
+	uint16_t flags;             // Flags()
+	uint16_t nomAvailCapacity;  // NominalAvailableCapacity() (mAh)
+	uint16_t fullAvailCapacity; // FullAvailableCapacity() (mAh)
+	uint16_t remCapacity;       // RemainingCapacity() (mAh)
+	uint16_t fullCapacity;      // FullChargeCapacity() (mAh)
+	int16_t  avgCurrent;        // AverageCurrent() (mA), >0 indicates charging
+	int16_t  stbyCurrent;       // StandbyCurrent() (mA)
+	int16_t  maxCurrent;        // MaxLoadCurrent() (mA)
+	int16_t  avgPower;          // AveragePower() (mW)
+	uint16_t soc;               // StateOfCharge() (%)
+	uint16_t intTemperature;    // InternalTemperature() (0.1K)
+	uint8_t  sohPercent;        // StateOfHealth() percentage (%)
+	uint8_t  sohStatus;         // StateOfHealth() status bits
+	uint16_t remCapUnfl;        // RemainingCapacityUnfiltered() (mAh)
+	uint16_t remCapFil;         // RemainingCapacityFiltered() (mAh)
+	uint16_t fullCapUnfl;       // FullChargeCapacityUnfiltered() (mAh)
+	uint16_t fullCapFil;        // FullChargeCapacityFiltered() (mAh)
+	uint16_t socUnfl;           // StateOfChargeUnfiltered() (%)
+} bq27441_snapshot;
+
+// I2C traffic of one command group, counted while profileBus() is enabled
+typedef struct {
+	uint16_t transactions; // I2C transactions (a register read is two: sub-address write + read)
+	uint16_t bytes;        // Bytes on the bus, including sub-addresses
+	uint32_t waitMicros;   // Time spent polling Wire.available() for read data
+	uint16_t timeouts;     // Reads whose data never arrived
+} bq27441_bus_counter;
+
+// I2C traffic recorded by profileBus(), grouped by the registers accessed
+typedef struct {
+	bq27441_bus_counter standard; // Standard and extended commands (0x02 ~ 0x3D)
+	bq27441_bus_counter control;  // Control() subcommands (0x00 ~ 0x01)
+	bq27441_bus_counter block;    // Data Memory access: DataClass() ~ BlockDataControl() (0x3E ~ 0x61)
+} bq27441_bus_stats;
+
 class BQ27441 {
 public:
 	//////////////////////////////
@@ -95,9 +173,20 @@ public:
 	    Initializes I2C and verifies communication with the BQ27441.
 		Must be called before using any other functions.
 		
+		@param wirePort is the I2C bus the BQ27441 is on
+		@return true if communication was successful.
+	*/
+	bool begin(TwoWire & wirePort = Wire);
+	
+	/**
+	    Verifies communication with a BQ27441 behind a mux. The channel is
+		selected before each transfer. Call mux.begin() first.
+		
+		@param mux is the TCA9548A the BQ27441 is behind
+		@param channel is the mux channel of the BQ27441 (0~7)
 		@return true if communication was successful.
 	*/
-	bool begin(void);
+	bool begin(TCA9548A & mux, uint8_t channel);
 	
 	/**
 	    Configures the design capacity and energy of the connected battery.
@@ -108,6 +197,13 @@ public:
 	*/
 	bool setCapacity(uint16_t capacity, uint16_t energy);
 
+	/**
+	    Reads the design energy of the connected battery.
+		
+		@return Design Energy (mWh)
+	*/
+	uint16_t designEnergy(void);
+
 	/**
 	    Configures the Taper Rate of battery fuel gauge.
 		
@@ -116,6 +212,13 @@ public:
 	*/
 	bool setTaperRate(uint16_t taperRate);
 
+	/**
+	    Reads the Taper Rate of battery fuel gauge.
+		
+		@return Taper Rate (0.1 Hr)
+	*/
+	uint16_t taperRate(void);
+
 	/**
 	    Set the Terminate Voltage of the battery fuel gauge 
 		
@@ -124,6 +227,13 @@ public:
 	*/
 	bool setTerminateVoltage(uint16_t voltage);
 
+	/**
+	    Reads the Terminate Voltage of the battery fuel gauge
+		
+		@return voltage (mV)
+	*/
+	uint16_t terminateVoltage(void);
+
 	/**
 		Set the Update Status Register of the battery fuel gauge
 
@@ -222,6 +332,57 @@ public:
 	*/
 	uint16_t temperature(temp_measure type = BATTERY);
 	
+	/**
+	    Reads every standard command from Temperature() to StateOfChargeUnfiltered()
+		in auto-incrementing I2C bursts and decodes them into a snapshot
+		
+		@param snap is the snapshot struct to be filled
+		@return true on success
+	*/
+	bool snapshot(bq27441_snapshot & snap);
+	
+	/**
+	    Read one register of the typed register map (see BQ27441_Registers.h)
+		in a single transfer of its width
+		
+		    uint16_t mV = lipo.read<BQ27441Reg::Voltage>();
+		
+		@return the register value, 0 on error (see lastError())
+	*/
+	template <typename Reg>
+	typename Reg::type read(void)
+	{
+		uint8_t data[Reg::width];
+		i2cReadBytes(Reg::address, data, Reg::width); // Zero-filled on error
+		return Reg::decode(data);
+	}
+	
+	/**
+	    Read a group of registers in one I2C burst, from the lowest address to
+		the end of the highest. The registers don't need to be adjacent, but
+		the span between them is read too and must fit in the Wire buffer.
+		
+		    int16_t mA;
+		    uint16_t soc;
+		    lipo.read<BQ27441Reg::AverageCurrent, BQ27441Reg::StateOfCharge>(mA, soc);
+		
+		@param values receive the register values, in the order of the registers
+		@return true on success
+	*/
+	template <typename... Regs>
+	bool read(typename Regs::type &... values)
+	{
+		typedef BQ27441Reg::Span<Regs...> span;
+		static_assert(span::end - span::first <= BQ27441_I2C_BUFFER, 
+		              "Registers read together must fit in one I2C burst");
+		uint8_t data[span::end - span::first];
+		if (i2cReadBytes(span::first, data, sizeof(data)) != BQ27441_OK)
+			return false;
+		int decoded[] = { (values = Regs::decode(data + (Regs::address - span::first)), 0)... };
+		(void)decoded;
+		return true;
+	}
+	
 	////////////////////////////	
 	// GPOUT Control Commands //
 	////////////////////////////
@@ -346,6 +507,14 @@ public:
 	*/
 	uint16_t deviceType(void);
 	
+	/**
+	    Read the Data Memory code - identifies the Data Memory
+		configuration the gauge was built with
+		
+		@return 16-bit value read from DM_CODE subcommand
+	*/
+	uint16_t dmCode(void);
+	
 	/**
 	    Enter configuration mode - set userControl if calling from an Arduino
 		sketch and you want control over when to exitConfig.
@@ -364,6 +533,44 @@ public:
 	*/
 	bool exitConfig(bool resim = true);
 	
+	/**
+	    Start entering configuration mode without waiting for it: unseal if
+		needed and send SET_CFGUPDATE. Call poll() until it stops returning
+		POLL_PENDING.
+		
+		@param userControl as in enterConfig()
+		@return true if SET_CFGUPDATE was sent
+	*/
+	bool beginEnterConfig(bool userControl = true);
+	
+	/**
+	    Start exiting configuration mode without waiting for it. Without resim
+		the exit is immediate, with resim call poll() until it stops returning
+		POLL_PENDING.
+		
+		@param resim is true if resimulation should be performed after exiting
+		@return true if the exit command was sent
+	*/
+	bool beginExitConfig(bool resim = true);
+	
+	/**
+	    Start waiting for the gauge to finish initialization after a power-on
+		reset (CONTROL_STATUS[INITCOMP]). Call poll() until it stops returning
+		POLL_PENDING.
+		
+		@return always true
+	*/
+	bool beginWaitInit(void);
+	
+	/**
+	    Advance the operation started by beginEnterConfig(), beginExitConfig()
+		or beginWaitInit(). Each call costs one register read and never delays.
+		
+		@return POLL_PENDING, POLL_DONE, or POLL_ERROR if the operation timed
+		out after BQ72441_I2C_TIMEOUT ms
+	*/
+	poll_result poll(void);
+	
 	/**
 	    Read the flags() command
 		
@@ -378,11 +585,134 @@ public:
 	*/
 	uint16_t status(void);
 	
+	/**
+	    Start staging Data Memory writes. Until commitStagedWrites(), the set...()
+		functions edit a shadow copy of their 32-byte block instead of writing
+		to the IC. Each block is loaded once, then committed when a write moves
+		to another block or at commitStagedWrites(): only the bytes that changed
+		are written, followed by a locally computed checksum. A block with no
+		changes is not written at all.
+		Group the writes by class - returning to a committed block loads it again.
+		Must be called in config mode (see ConfigSession).
+	*/
+	void beginStagedWrites(void);
+	
+	/**
+	    Commit the staged block and stop staging
+		
+		@return true if every staged block was committed successfully
+	*/
+	bool commitStagedWrites(void);
+	
+	/**
+	    Count every I2C transaction the library makes into a stats struct owned
+		by the caller. The counters are added to, not cleared, so one struct can
+		cover a whole wake cycle. Profiling costs nothing while disabled.
+		
+		@param stats is the struct to add to, or NULL to stop profiling
+	*/
+	void profileBus(bq27441_bus_stats * stats) { _busStats = stats; }
+	
+	/**
+	    Set the deadline of each I2C read. A read whose data hasn't arrived
+		by then fails with BQ27441_ERR_TIMEOUT instead of stalling.
+		
+		@param timeoutMicros is the deadline in microseconds (BQ27441_I2C_DEADLINE by default)
+	*/
+	void setI2CTimeout(uint32_t timeoutMicros) { _timeoutMicros = timeoutMicros; }
+	
+	/**
+	    Get the error of the most recent failed I2C transfer. Getters return 0
+		when their read fails, so check lastError() to tell that from a real 0.
+		The error is kept until clearError().
+		
+		@return BQ27441_OK if every transfer since clearError() succeeded
+	*/
+	bq27441_error lastError(void) const { return _lastError; }
+	
+	/**
+	    Clear the error reported by lastError()
+	*/
+	void clearError(void) { _lastError = BQ27441_OK; }
+	
+	/**
+	    Scoped configuration mode. Enters config mode once when constructed and
+		exits when it goes out of scope, so any number of Data Memory reads and
+		writes can share one SET_CFGUPDATE. A session opened while the gauge is
+		already in user-controlled config mode does nothing, so helpers can open
+		their own session and still share the caller's.
+		
+		    {
+		        BQ27441::ConfigSession config(lipo);
+		        qmax = lipo.Qmax();
+		        lipo.RaTable(ra);
+		    } // exitConfig() here
+	*/
+	class ConfigSession {
+	public:
+		/**
+		    @param lipo is the gauge to put into config mode
+			       resim is true if a resimulation should be performed on exit
+		*/
+		ConfigSession(BQ27441 & lipo, bool resim = false);
+		~ConfigSession();
+		
+		/**
+		    @return true if config mode was entered (or was already active)
+		*/
+		bool active(void) const { return _active; }
+		
+		/**
+		    Choose between EXIT_CFGUPDATE and SOFT_RESET (resim) on exit
+		*/
+		void setResim(bool resim) { _resim = resim; }
+		
+		/**
+		    Exit config mode before the session goes out of scope
+			
+			@return true on success (always true if the session doesn't own config mode)
+		*/
+		bool exit(void);
+		
+	private:
+		BQ27441 & _lipo;
+		bool _owner;  // This session entered config mode and must exit it
+		bool _active;
+		bool _resim;
+		
+		ConfigSession(const ConfigSession &);             // Non-copyable
+		ConfigSession & operator=(const ConfigSession &);
+	};
+	
 private:
 	uint8_t _deviceAddress;  // Stores the BQ27441-G1A's I2C address
+	TwoWire * _i2cPort;      // I2C bus of the BQ27441-G1A
+	TCA9548A * _mux;         // Mux the BQ27441-G1A is behind, NULL if none
+	uint8_t _muxChannel;     // Mux channel of the BQ27441-G1A
 	bool _sealFlag; // Global to identify that IC was previously sealed
 	bool _userConfigControl; // Global to identify that user has control over 
 	                         // entering/exiting config
+	uint8_t _blockData[32];  // Buffer of the BlockData() window last read from the IC
+	uint8_t _blockClass;     // Data class selected with DataClass()
+	uint8_t _blockIndex;     // 32-byte block selected with DataBlock()
+	bool _blockValid;        // _blockData mirrors the selected block
+	uint8_t _stagedData[32]; // Shadow of the selected block with the staged edits applied
+	bool _staging;           // Writes are staged until commitStagedWrites()
+	bool _stagePending;      // _stagedData holds edits not yet committed
+	bool _stageSuccess;      // No block commit failed since beginStagedWrites()
+	uint8_t _pollOp;         // Operation advanced by poll()
+	unsigned long _pollStart;// millis() when the poll() operation was started
+	bq27441_bus_stats * _busStats; // Where profileBus() records, NULL when disabled
+	uint32_t _timeoutMicros;       // Deadline of one I2C read
+	bq27441_error _lastError;      // Most recent failure, kept until clearError()
+	bq27441_error _transferError;  // Result of the most recent transfer
+	
+	/**
+	    Call poll() until the pending operation completes
+		
+		@return true if it completed successfully
+	*/
+	bool waitPoll(void);
 	
 	/**
 	    Check if the BQ27441-G1A is sealed or not.
@@ -434,19 +764,11 @@ private:
 	*/	
 	bool exitResim(void);
 	
-	/**
-	    Read a 16-bit command word from the BQ27441-G1A
-		
-		@param subAddress is the command to be read from
-		@return 16-bit value of the command's contents
-	*/	
-	uint16_t readWord(uint16_t subAddress);
-	
 	/**
 	    Read a 16-bit subcommand() from the BQ27441-G1A's control()
 		
 		@param function is the subcommand of control() to be read
-		@return 16-bit value of the subcommand's contents
+		@return 16-bit value of the subcommand's contents, 0 on error (see lastError())
 	*/	
 	uint16_t readControlWord(uint16_t function);
 	
@@ -484,6 +806,23 @@ private:
 	*/
 	bool blockDataOffset(uint8_t offset);
 	
+	/**
+	    Select a class and block for BlockData() access and load it into the
+		block buffer. Does nothing if that block is already buffered.
+		
+		@param classID is the id of the class to be selected
+		       block is the 32-byte block index within the class
+		@return true on success
+	*/
+	bool selectBlock(uint8_t classID, uint8_t block);
+	
+	/**
+	    Read all 32 bytes of BlockData() into the block buffer in one burst
+		
+		@return true on success
+	*/
+	bool readBlock(void);
+	
 	/**
 	    Read the current checksum using BlockDataCheckSum()
 		
@@ -492,25 +831,45 @@ private:
 	uint8_t blockDataChecksum(void);
 	
 	/**
-	    Use BlockData() to read a byte from the loaded extended data
+	    Read a byte of the loaded extended data from the block buffer
 		
 		@param offset of data block byte to be read
-		@return true on success
+		@return the byte at offset
 	*/
 	uint8_t readBlockData(uint8_t offset);
 	
 	/**
-	    Use BlockData() to write a byte to an offset of the loaded data
+	    Use BlockData() to write a run of bytes to an offset of the loaded data
+		in one burst, and keep the block buffer in step
+		
+		@param offset is the position of the first byte to be written
+		       data is the data buffer to be written
+			   len is the number of bytes to be written
+		@return true on success
+	*/
+	bool writeBlockData(uint8_t offset, uint8_t * data, uint8_t len);
+	
+	/**
+	    Load a block into the staging shadow, committing the pending block first
+		if it is a different one.
 		
-		@param offset is the position of the byte to be written
-		       data is the value to be written
+		@param classID is the id of the class to be staged
+		       block is the 32-byte block index within the class
 		@return true on success
 	*/
-	bool writeBlockData(uint8_t offset, uint8_t data);
+	bool stageBlock(uint8_t classID, uint8_t block);
+	
+	/**
+	    Commit the staged block: write the bytes that differ from the loaded
+		block, then the checksum computed from the shadow.
+		
+		@return true on success, or if there was nothing to commit
+	*/
+	bool commitBlock(void);
 	
 	/**
-	    Read all 32 bytes of the loaded extended data and compute a 
-		checksum based on the values.
+	    Compute a checksum based on all 32 bytes of the loaded extended data,
+		reading them into the block buffer first if needed.
 		
 		@return 8-bit checksum value calculated based on loaded data
 	*/
@@ -556,11 +915,22 @@ private:
 	    Read a specified number of bytes over I2C at a given subAddress
 		
 		@param subAddress is the 8-bit address of the data to be read
+		       dest is the data buffer to be written to, zero-filled on error
+			   count is the number of bytes to be read
+		@return BQ27441_OK on success, or the error that stopped the read
+	*/
+	bq27441_error i2cReadBytes(uint8_t subAddress, uint8_t * dest, uint8_t count);
+	
+	/**
+	    Read a run of consecutive registers of any length, split into bursts 
+		that fit in the Wire buffer
+		
+		@param subAddress is the 8-bit address of the first register
 		       dest is the data buffer to be written to
 			   count is the number of bytes to be read
 		@return true on success
 	*/
-	int16_t i2cReadBytes(uint8_t subAddress, uint8_t * dest, uint8_t count);
+	bool i2cReadBlock(uint8_t subAddress, uint8_t * dest, uint8_t count);
 	
 	/**
 	    Write a specified number of bytes over I2C to a given subAddress
@@ -568,9 +938,40 @@ private:
 		@param subAddress is the 8-bit address of the data to be written to
 		       src is the data buffer to be written
 			   count is the number of bytes to be written
-		@return true on success
+		@return BQ27441_OK on success, or the error reported by Wire
+	*/
+	bq27441_error i2cWriteBytes(uint8_t subAddress, uint8_t * src, uint8_t count);
+	
+	/**
+	    Translate a Wire.endTransmission() status into an error code
+		
+		@param status is the value returned by Wire.endTransmission()
+		@return the matching bq27441_error
+	*/
+	static bq27441_error wireError(uint8_t status);
+	
+	/**
+	    Connect the BQ27441-G1A to the bus, if it is behind a mux
+		
+		@return BQ27441_OK on success, or BQ27441_ERR_MUX
+	*/
+	bq27441_error selectChannel(void);
+	
+	/**
+	    Record the result of a transfer for lastError() and poll()
+		
+		@param error is the result of the transfer
+		@return error, unchanged
+	*/
+	bq27441_error transferResult(bq27441_error error);
+	
+	/**
+	    Select the profileBus() counter for transactions at a given subAddress
+		
+		@param subAddress is the 8-bit address the transaction starts at
+		@return the counter to add to
 	*/
-	uint16_t i2cWriteBytes(uint8_t subAddress, uint8_t * src, uint8_t count);
+	bq27441_bus_counter * busCounter(uint8_t subAddress);
 };
 
 // extern BQ27441 lipo; // Use lipo.[] to interact with the library in an Arduino sketch
@@ -0,0 +1,42 @@
+/*
+ * Battery Voltage Acquisition on A0
+ * Trimmed-mean filter of a burst of ADC samples, see adc_battery.h.
+ */
+
+#include <ESP8266WiFi.h>
+#include "adc_battery.h"
+
+uint16 adcReadMillivolts(const AdcConfig & config)
+{
+  uint8 samples = constrain(config.samples, 1, ADC_MAX_SAMPLES);
+  uint8 trim = (config.trim * 2 < samples) ? config.trim : (samples - 1) / 2;
+
+  // Insertion sort as the samples come in, at most 64 of them
+  uint16 sorted[ADC_MAX_SAMPLES];
+  for (uint8 n = 0; n < samples; n++) {
+    uint16 value = analogRead(A0);
+    uint8 i = n;
+    for (; i > 0 && sorted[i - 1] > value; i--)
+      sorted[i] = sorted[i - 1];
+    sorted[i] = value;
+  }
+
+  uint32 sum = 0;
+  uint8 kept = samples - 2 * trim;
+  for (uint8 i = trim; i < samples - trim; i++)
+    sum += sorted[i];
+
+  // Rounded: mV = (sum / kept) * mvNum / mvDen
+  uint32 den = (uint32)kept * config.mvDen;
+  return (sum * config.mvNum + den / 2) / den;
+}
+
+uint16 adcReadRadioOff(const AdcConfig & config)
+{
+  WiFi.forceSleepBegin();
+  delay(1);                   // Modem goes to sleep on the next SDK tick
+  uint16 mV = adcReadMillivolts(config);
+  WiFi.forceSleepWake();
+  delay(1);
+  return mV;
+}
@@ -0,0 +1,25 @@
+#ifndef adc_battery_h
+#define adc_battery_h
+
+#include <Arduino.h>
+
+// Battery voltage on A0 in integer mV: a burst of samples is sorted, the extremes are dropped
+// as outliers, and the rest is averaged (trimmed mean). Scaled through the voltage divider as
+// mV = counts * mvNum / mvDen.
+#define ADC_MAX_SAMPLES 64
+
+struct AdcConfig {
+  uint8 samples;      // Samples per reading, 1~ADC_MAX_SAMPLES
+  uint8 trim;         // Samples dropped at each end, less than samples/2
+  uint16 mvNum;       // Divider scale numerator
+  uint16 mvDen;       // Divider scale denominator
+};
+
+// Read the battery voltage (mV)
+uint16 adcReadMillivolts(const AdcConfig & config);
+
+// Read the battery voltage (mV) with the WiFi modem asleep, away from RF-induced noise.
+// Call it before the radio is started, association is not kept.
+uint16 adcReadRadioOff(const AdcConfig & config);
+
+#endif //adc_battery_h
@@ -0,0 +1,204 @@
+/*
+ * BME280 Forced Mode Acquisition
+ * One-shot conversions with per-channel oversampling, see bme280_forced.h.
+ */
+
+#include <Wire.h>
+#include "bme280_forced.h"
+
+// BME280 registers
+#define BME280_REG_CALIB_TP   0x88    // dig_T1 ~ dig_H1, 26 bytes
+#define BME280_REG_CHIP_ID    0xD0
+#define BME280_REG_RESET      0xE0
+#define BME280_REG_CALIB_H    0xE1    // dig_H2 ~ dig_H6, 7 bytes
+#define BME280_REG_CTRL_HUM   0xF2
+#define BME280_REG_STATUS     0xF3
+#define BME280_REG_CTRL_MEAS  0xF4
+#define BME280_REG_CONFIG     0xF5
+#define BME280_REG_DATA       0xF7    // press, temp, hum, 8 bytes
+
+#define BME280_CHIP_ID        0x60
+#define BME280_RESET_WORD     0xB6
+#define BME280_STATUS_IM_UPDATE 0x01  // NVM calibration is being copied
+#define BME280_MODE_SLEEP     0x00
+#define BME280_MODE_FORCED    0x01
+
+// Trimming parameters, read once in bme280Begin()
+static struct {
+  uint16 T1; int16_t T2, T3;
+  uint16 P1; int16_t P2, P3, P4, P5, P6, P7, P8, P9;
+  uint8 H1; int16_t H2; uint8 H3; int16_t H4, H5; int8_t H6;
+} calib;
+
+static Bme280Config bme_config;
+static uint8 bme_ctrl_meas;           // osrs_t, osrs_p and forced mode
+static uint32 bme_start;              // micros() of bme280Start()
+static bool bme_converting;           // bme280Start() is waiting for bme280Collect()
+
+static bool writeRegister(uint8 reg, uint8 value)
+{
+  Wire.beginTransmission(bme_config.address);
+  Wire.write(reg);
+  Wire.write(value);
+  return Wire.endTransmission() == 0;
+}
+
+static bool readRegisters(uint8 reg, uint8 * data, uint8 count)
+{
+  Wire.beginTransmission(bme_config.address);
+  Wire.write(reg);
+  if (Wire.endTransmission() != 0)
+    return false;
+  if (Wire.requestFrom(bme_config.address, count) != count)
+    return false;
+  for (uint8 i = 0; i < count; i++)
+    data[i] = Wire.read();
+  return true;
+}
+
+static uint16 le16(const uint8 * p) { return ((uint16)p[1] << 8) | p[0]; }
+
+bool bme280Begin(const Bme280Config & config)
+{
+  bme_config = config;
+  if (bme_config.temperature == BME280_SKIP)
+    bme_config.temperature = BME280_X1;   // t_fine compensates the other channels
+  bme_converting = false;
+
+  Wire.begin();
+  uint8 id;
+  if (!readRegisters(BME280_REG_CHIP_ID, &id, 1) || id != BME280_CHIP_ID)
+    return false;
+
+  // Soft reset puts the sensor in sleep mode, wait for it to reload its calibration
+  if (!writeRegister(BME280_REG_RESET, BME280_RESET_WORD))
+    return false;
+  uint8 status = BME280_STATUS_IM_UPDATE;
+  for (int i = 0; i < 10 && (status & BME280_STATUS_IM_UPDATE); i++) {
+    delay(2);
+    if (!readRegisters(BME280_REG_STATUS, &status, 1))
+      return false;
+  }
+
+  uint8 tp[26], h[7];
+  if (!readRegisters(BME280_REG_CALIB_TP, tp, sizeof(tp)) ||
+      !readRegisters(BME280_REG_CALIB_H, h, sizeof(h)))
+    return false;
+  calib.T1 = le16(tp + 0);  calib.T2 = le16(tp + 2);  calib.T3 = le16(tp + 4);
+  calib.P1 = le16(tp + 6);  calib.P2 = le16(tp + 8);  calib.P3 = le16(tp + 10);
+  calib.P4 = le16(tp + 12); calib.P5 = le16(tp + 14); calib.P6 = le16(tp + 16);
+  calib.P7 = le16(tp + 18); calib.P8 = le16(tp + 20); calib.P9 = le16(tp + 22);
+  calib.H1 = tp[25];
+  calib.H2 = le16(h + 0);
+  calib.H3 = h[2];
+  calib.H4 = ((int16_t)(int8_t)h[3] << 4) | (h[4] & 0x0F);
+  calib.H5 = ((int16_t)(int8_t)h[5] << 4) | (h[4] >> 4);
+  calib.H6 = (int8_t)h[6];
+
+  // ctrl_hum only takes effect with the next ctrl_meas write. No IIR filter, it would
+  // need a conversion history the sensor doesn't keep between forced conversions.
+  bme_ctrl_meas = (bme_config.temperature << 5) | (bme_config.pressure << 2) | BME280_MODE_FORCED;
+  return writeRegister(BME280_REG_CTRL_HUM, bme_config.humidity) &&
+         writeRegister(BME280_REG_CONFIG, 0x00) &&
+         writeRegister(BME280_REG_CTRL_MEAS, (bme_ctrl_meas & ~0x03) | BME280_MODE_SLEEP);
+}
+
+// Datasheet 9.1: t_max = 1.25 + 2.3*T + (2.3*P + 0.575) + (2.3*H + 0.575) ms
+uint32 bme280ConversionTime()
+{
+  static const uint8 samples[] = { 0, 1, 2, 4, 8, 16 };
+  uint32 us = 1250 + 2300 * samples[bme_config.temperature];
+  if (bme_config.pressure != BME280_SKIP)
+    us += 2300 * samples[bme_config.pressure] + 575;
+  if (bme_config.humidity != BME280_SKIP)
+    us += 2300 * samples[bme_config.humidity] + 575;
+  return us;
+}
+
+bool bme280Start()
+{
+  if (!writeRegister(BME280_REG_CTRL_MEAS, bme_ctrl_meas))
+    return false;
+  bme_start = micros();
+  bme_converting = true;
+  return true;
+}
+
+// Compensation formulas of the datasheet (section 4.2.3, 32/64-bit integer versions)
+static int32_t compensateTemperature(int32_t adc, int32_t & t_fine)
+{
+  int32_t var1 = ((((adc >> 3) - ((int32_t)calib.T1 << 1))) * ((int32_t)calib.T2)) >> 11;
+  int32_t var2 = (((((adc >> 4) - ((int32_t)calib.T1)) * ((adc >> 4) - ((int32_t)calib.T1))) >> 12) *
+                ((int32_t)calib.T3)) >> 14;
+  t_fine = var1 + var2;
+  return (t_fine * 5 + 128) >> 8;
+}
+
+static uint32 compensatePressure(int32_t adc, int32_t t_fine)
+{
+  int64_t var1 = ((int64_t)t_fine) - 128000;
+  int64_t var2 = var1 * var1 * (int64_t)calib.P6;
+  var2 = var2 + ((var1 * (int64_t)calib.P5) << 17);
+  var2 = var2 + (((int64_t)calib.P4) << 35);
+  var1 = ((var1 * var1 * (int64_t)calib.P3) >> 8) + ((var1 * (int64_t)calib.P2) << 12);
+  var1 = (((((int64_t)1) << 47) + var1)) * ((int64_t)calib.P1) >> 33;
+  if (var1 == 0)
+    return 0;   // Avoid a division by zero
+  int64_t p = 1048576 - adc;
+  p = (((p << 31) - var2) * 3125) / var1;
+  var1 = (((int64_t)calib.P9) * (p >> 13) * (p >> 13)) >> 25;
+  var2 = (((int64_t)calib.P8) * p) >> 19;
+  p = ((p + var1 + var2) >> 8) + (((int64_t)calib.P7) << 4);
+  return (uint32)p;
+}
+
+static uint32 compensateHumidity(int32_t adc, int32_t t_fine)
+{
+  int32_t v = t_fine - ((int32_t)76800);
+  v = (((((adc << 14) - (((int32_t)calib.H4) << 20) - (((int32_t)calib.H5) * v)) + ((int32_t)16384)) >> 15) *
+       (((((((v * ((int32_t)calib.H6)) >> 10) * (((v * ((int32_t)calib.H3)) >> 11) + ((int32_t)32768))) >> 10) +
+          ((int32_t)2097152)) * ((int32_t)calib.H2) + 8192) >> 14));
+  v = (v - (((((v >> 15) * (v >> 15)) >> 7) * ((int32_t)calib.H1)) >> 4));
+  v = (v < 0) ? 0 : v;
+  v = (v > 419430400) ? 419430400 : v;
+  return (uint32)(v >> 12);
+}
+
+bool bme280Collect(Bme280Sample & sample)
+{
+  if (!bme_converting)
+    return false;
+  uint32 elapsed = micros() - bme_start;
+  uint32 conversion = bme280ConversionTime();
+  if (elapsed < conversion) {
+    uint32 rest = conversion - elapsed;
+    delay(rest / 1000);           // Lets the WiFi stack run
+    delayMicroseconds(rest % 1000);
+  }
+  bme_converting = false;
+
+  // All three channels in one burst
+  uint8 data[8];
+  if (!readRegisters(BME280_REG_DATA, data, sizeof(data)))
+    return false;
+  int32_t adcP = ((uint32)data[0] << 12) | ((uint32)data[1] << 4) | (data[2] >> 4);
+  int32_t adcT = ((uint32)data[3] << 12) | ((uint32)data[4] << 4) | (data[5] >> 4);
+  int32_t adcH = ((uint32)data[6] << 8) | data[7];
+
+  int32_t t_fine;
+  sample.temperature = compensateTemperature(adcT, t_fine);
+  sample.pressure = (bme_config.pressure != BME280_SKIP) ? compensatePressure(adcP, t_fine) : 0;
+  sample.humidity = (bme_config.humidity != BME280_SKIP) ? compensateHumidity(adcH, t_fine) : 0;
+  return true;
+}
+
+bool bme280Read(Bme280Sample & sample)
+{
+  return bme280Start() && bme280Collect(sample);
+}
+
+float bme280SeaLevelPressure(const Bme280Sample & sample, float altitude)
+{
+  float hPa = sample.pressure / 25600.0F;
+  return hPa / pow(1.0F - (altitude / 44330.0F), 5.255F);
+}
@@ -0,0 +1,46 @@
+#ifndef bme280_forced_h
+#define bme280_forced_h
+
+#include <Arduino.h>
+
+// BME280 in forced mode: the sensor sleeps between wakes, each reading is one conversion
+// triggered on demand, read back in one burst and compensated in one pass (integer formulas
+// of the Bosch datasheet). bme280Start() and bme280Collect() let other work run during the
+// conversion, bme280Read() does both.
+
+// Oversampling of a channel (osrs_t, osrs_p, osrs_h register fields)
+enum Bme280Oversampling { BME280_SKIP, BME280_X1, BME280_X2, BME280_X4, BME280_X8, BME280_X16 };
+
+struct Bme280Config {
+  uint8 address;                    // I2C address, 0x76 or 0x77
+  Bme280Oversampling temperature;   // Temperature is always measured, SKIP counts as X1
+  Bme280Oversampling pressure;
+  Bme280Oversampling humidity;
+};
+
+// Compensated conversion, channels that were skipped read 0
+struct Bme280Sample {
+  int32_t temperature;  // (0.01 C)
+  uint32 pressure;      // (1/256 Pa)
+  uint32 humidity;      // (1/1024 %RH)
+};
+
+// Reset the sensor, read its calibration and leave it asleep. false if no BME280 answers.
+bool bme280Begin(const Bme280Config & config);
+
+// Longest conversion time (us) of the configured oversampling, from the datasheet
+uint32 bme280ConversionTime();
+
+// Trigger one forced conversion, the sensor goes back to sleep when it is done
+bool bme280Start();
+
+// Wait for the conversion started by bme280Start(), read and compensate it
+bool bme280Collect(Bme280Sample & sample);
+
+// One forced conversion: bme280Start() then bme280Collect()
+bool bme280Read(Bme280Sample & sample);
+
+// Pressure reduced to sea level (hPa)
+float bme280SeaLevelPressure(const Bme280Sample & sample, float altitude);
+
+#endif //bme280_forced_h
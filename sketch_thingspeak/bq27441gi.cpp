@@ -7,102 +7,231 @@
 
 #include <SparkFunBQ27441.h>
 #include "bq27441gi.h"
+#include <EEPROM.h>
+#include "rtc_memory.h"
 
 // Compiler directives, comment out to disable
 #define DEV_MODE        // Developer Mode
 
-//#define BAT_1         // (eBay_803035)
-//#define BAT_2         // (eBay_501235)
-//#define BAT_3         // (PKCell_803860)
-//#define BAT_4         // (Panasonic_B-Grn)
-//#define BAT_5         // (Sanyo_GA-Red)
-#define BAT_6         // (Samsung_30Q-Pink)
-//#define BAT_7         // (Samsung_25R-Grn)
-
 // BQ27441 Fuel Gauge Saved Golden Images
 // Note: On Sparkfun BS, R_iset is changed to 825Ω, the new I_term is (0.1 * 890/820) = 110mA.
 //       If bat < 1000mAh, Taper current = I-term + 90mA, otherwise Taper current = 0.1 C (±10%)
-
-// BAT_1 (eBay_803035): 850mAh@3.7V Taper=45 Qmax=16422
-#ifdef BAT_1
-const unsigned int design_capacity = 850;   // (mAh)
-const unsigned int design_energy = 850*3.7; // = Capacity * Nominal Voltage
-const unsigned int taper_rate = 45;         // Taper current = 850/4.5 = 190mA
-const unsigned int saved_qmax = 16422;      // Set to -1 if battery data not available
-uint16 saved_ra_table[] = {71,71,75,87,73,75,87,103,105,109,133,157,258,637,1014};
-#endif //BAT_1
-
-// BAT_2 (eBay_501235): 180mAh@3.7V Taper=75 Qmax=16521
-#ifdef BAT_2
-const unsigned int design_capacity = 180;    // (mAh)
-const unsigned int design_energy = 180*3.7;  // = Capacity * Nominal Voltage
-const unsigned int taper_rate = 75;          // Taper current = 180/7.5 = 24mA
-const unsigned int saved_qmax = 16521;       // Set to -1 if battery data not available
-uint16 saved_ra_table[] = {49,49,39,34,17,13,22,40,49,80,157,245,512,1361,2179};
-#endif //BAT_2
-
-// BAT_3 (PKCell_803860): 2000mAh@3.7V Taper=95 Qmax=16572
-#ifdef BAT_3
-const unsigned int design_capacity = 2000;   // (mAh)
-const unsigned int design_energy = 2000*3.7; // = Capacity * Nominal Voltage
-const unsigned int taper_rate = 95;          // Taper current = 2000/9.5 = 210mA
-const unsigned int saved_qmax = 16572;       // Set to -1 if battery data not available
-uint16 saved_ra_table[] = {62,62,62,69,50,46,52,57,55,55,70,86,165,424,677};
-#endif //BAT_3
-
-// BAT_4 (Panasonic_B-Grn): 3400mAh@3.6V Taper=112 Qmax=16509
-#ifdef BAT_4
-const unsigned int design_capacity = 3400;   // (mAh)
-const unsigned int design_energy = 3400*3.6; // = Capacity * Nominal Voltage
-const unsigned int taper_rate = 112;         // Taper current = 3400/11.2 = 300mA
-const unsigned int saved_qmax = 16509;       // Set to -1 if battery data not available
-uint16 saved_ra_table[] = {219,219,217,238,165,138,148,155,135,125,162,195,392,1026,1633};
-#endif //BAT_4
-
-// BAT_5 (Sanyo_GA-Red): 3500mAh@3.6V Taper=113 Qmax=16432
-#ifdef BAT_5
-const unsigned int design_capacity = 3500;   // (mAh)
-const unsigned int design_energy = 3500*3.6; // = Capacity * Nominal Voltage
-const unsigned int taper_rate = 115;         // Taper current = 3500/11.5 = 305mA
-const unsigned int saved_qmax = 16432;       // Set to -1 if battery data not available
-uint16 saved_ra_table[] = {161,161,156,173,121,102,111,116,103,96,126,152,306,801,1271};
-#endif //BAT_5
-
-// BAT_6 (Samsung_30Q-Pink): 3000mAh@3.6V Taper=110 Qmax=16632
-#ifdef BAT_6
-const unsigned int design_capacity = 3000;   // (mAh)
-const unsigned int design_energy = 3000*3.6; // = Capacity * Nominal Voltage
-const unsigned int taper_rate = 110;         // Taper current = 3000/11.0 = 270mA
-const unsigned int saved_qmax = 16632;       // Set to -1 if battery data not available
-uint16 saved_ra_table[] = {123,123,115,128,91,80,88,94,84,80,108,132,266,696,1108};
-
-#endif //BAT_6
-
-// BAT_7 (Samsung_25R-Grn): 2500mAh@3.6V Taper=108 Qmax=16474
-#ifdef BAT_7
-const unsigned int design_capacity = 2500;   // (mAh)
-const unsigned int design_energy = 2500*3.6; // = Capacity * Nominal Voltage
-const unsigned int taper_rate = 108;         // Taper current = 2500/10.8 = 230mA
-const unsigned int saved_qmax = 16474;       // Set to -1 if battery data not available
-uint16 saved_ra_table[] = {142,142,139,176,173,210,298,362,371,400,557,655,1232,3152,4990};
-#endif //BAT_7
+//       Design Energy = Capacity * Nominal Voltage
+static const GoldenImage golden_images[] PROGMEM = {
+  // 850mAh@3.7V, Taper current = 850/4.5 = 190mA
+  { "eBay_803035",      850,  850*37/10,  45,  16422,
+    {71,71,75,87,73,75,87,103,105,109,133,157,258,637,1014} },
+  // 180mAh@3.7V, Taper current = 180/7.5 = 24mA
+  { "eBay_501235",      180,  180*37/10,  75,  16521,
+    {49,49,39,34,17,13,22,40,49,80,157,245,512,1361,2179} },
+  // 2000mAh@3.7V, Taper current = 2000/9.5 = 210mA
+  { "PKCell_803860",    2000, 2000*37/10, 95,  16572,
+    {62,62,62,69,50,46,52,57,55,55,70,86,165,424,677} },
+  // 3400mAh@3.6V, Taper current = 3400/11.2 = 300mA
+  { "Panasonic_B-Grn",  3400, 3400*36/10, 112, 16509,
+    {219,219,217,238,165,138,148,155,135,125,162,195,392,1026,1633} },
+  // 3500mAh@3.6V, Taper current = 3500/11.5 = 305mA
+  { "Sanyo_GA-Red",     3500, 3500*36/10, 115, 16432,
+    {161,161,156,173,121,102,111,116,103,96,126,152,306,801,1271} },
+  // 3000mAh@3.6V, Taper current = 3000/11.0 = 270mA
+  { "Samsung_30Q-Pink", 3000, 3000*36/10, 110, 16632,
+    {123,123,115,128,91,80,88,94,84,80,108,132,266,696,1108} },
+  // 2500mAh@3.6V, Taper current = 2500/10.8 = 230mA
+  { "Samsung_25R-Grn",  2500, 2500*36/10, 108, 16474,
+    {142,142,139,176,173,210,298,362,371,400,557,655,1232,3152,4990} },
+};
+static const int golden_image_count = sizeof(golden_images) / sizeof(golden_images[0]);
 
 // Default Qmax = 16384
 // Default R_a Table = {102,102,99,107,72,59,62,63,53,47,60,70,140,369,588};
+#define GI_DM_CODE 0x0048   // Data Memory layout of the BQ27441-G1A the images were made for
+
+bool bq27441_SelectImage(GoldenImage & image, const char * batteryId, uint16 designCapacity)
+{
+  // A stored battery ID picks its own image, otherwise the first image of that capacity
+  for (int i = 0; batteryId && i < golden_image_count; i++) {
+    if (strcmp_P(batteryId, golden_images[i].name) == 0) {
+      memcpy_P(&image, &golden_images[i], sizeof(image));
+      return true;
+    }
+  }
+  for (int i = 0; i < golden_image_count; i++) {
+    if (pgm_read_word(&golden_images[i].designCapacity) == designCapacity) {
+      memcpy_P(&image, &golden_images[i], sizeof(image));
+      return true;
+    }
+  }
+  // No battery data. Do a learning cycle with the capacity, 3.7V, and the taper current above
+  uint16 taperCurrent = (designCapacity < 1000) ? 200 : designCapacity / 10;
+  memset(&image, 0, sizeof(image));
+  strncpy(image.name, batteryId ? batteryId : "Unknown", sizeof(image.name) - 1);
+  image.designCapacity = designCapacity;
+  image.designEnergy = (uint32)designCapacity * 37 / 10;
+  image.taperRate = (uint32)designCapacity * 10 / taperCurrent;
+  image.qmax = GI_NO_QMAX;
+  return false;
+}
+
+// EEPROM record of the learned parameters
+#define LEARNED_EEPROM_ADDR 0
+#define LEARNED_VERSION     1     // Change when the record layout changes
+struct LearnedRecord {
+  uint32 crc;                     // CRC32 of the rest of the record
+  uint32 version;
+  char   name[20];                // Battery ID and capacity the parameters were learned on
+  uint16 designCapacity;
+  uint16 qmax;
+  uint16 raTable[15];
+  uint16 reserved;                // Pads to a multiple of 4 bytes
+};
+
+// EEPROM record of the battery ID, after the learned parameters
+#define BATTERY_EEPROM_ADDR (LEARNED_EEPROM_ADDR + sizeof(LearnedRecord))
+struct BatteryRecord {
+  uint32 crc;                     // CRC32 of name
+  char   name[20];
+};
+
+// commit() rewrites the EEPROM sector with the bytes begin() mapped, map both records
+#define GI_EEPROM_SIZE (BATTERY_EEPROM_ADDR + sizeof(BatteryRecord))
+
+static uint32 learnedCrc(const LearnedRecord & record)
+{
+  return crc32(&record.version, sizeof(record) - sizeof(record.crc));
+}
+
+bool bq27441_SaveLearned(const GoldenImage & image, uint16 qmax, const uint16 * raTable)
+{
+  LearnedRecord record;
+  memset(&record, 0, sizeof(record));
+  record.version = LEARNED_VERSION;
+  memcpy(record.name, image.name, sizeof(record.name));
+  record.designCapacity = image.designCapacity;
+  record.qmax = qmax;
+  memcpy(record.raTable, raTable, sizeof(record.raTable));
+  record.crc = learnedCrc(record);
+
+  // Flash wears out, only write a record that changed
+  LearnedRecord saved;
+  EEPROM.begin(GI_EEPROM_SIZE);
+  EEPROM.get(LEARNED_EEPROM_ADDR, saved);
+  bool success = true;
+  if (memcmp(&saved, &record, sizeof(record)) != 0) {
+    EEPROM.put(LEARNED_EEPROM_ADDR, record);
+    success = EEPROM.commit();
+  }
+  EEPROM.end();
+  return success;
+}
+
+// Saved in RTC memory after each learned update was handled
+struct LearnedFlagsRecord {
+  uint32 status;        // QMAX_UP and RES_UP of the last call
+};
+
+bool bq27441_SaveLearnedOnUpdate(const GoldenImage & image, uint16 status, uint16 qmax,
+                                 const uint16 * raTable)
+{
+  const uint16 updated = BQ27441_STATUS_QMAX_UP | BQ27441_STATUS_RES_UP;
+  LearnedFlagsRecord record;
+  if (!rtcLoad(RTC_BLOCK_LEARNED, &record, sizeof(record)))
+    record.status = 0;            // Power-on, save what the gauge holds once
+  if ((status & ~record.status & updated) != 0 &&
+      !bq27441_SaveLearned(image, qmax, raTable))
+    return false;                 // The edge is kept, try again on the next wake
+  if ((record.status & updated) != (status & updated)) {
+    record.status = status & updated;
+    rtcSave(RTC_BLOCK_LEARNED, &record, sizeof(record));
+  }
+  return true;
+}
+
+bool bq27441_LoadLearned(GoldenImage & image)
+{
+  LearnedRecord record;
+  EEPROM.begin(GI_EEPROM_SIZE);
+  EEPROM.get(LEARNED_EEPROM_ADDR, record);
+  EEPROM.end();
+  if (record.version != LEARNED_VERSION || record.crc != learnedCrc(record))
+    return false;
+  if (record.designCapacity != image.designCapacity ||
+      strncmp(record.name, image.name, sizeof(record.name)) != 0)
+    return false;   // Learned on another battery
+  image.qmax = record.qmax;
+  memcpy(image.raTable, record.raTable, sizeof(image.raTable));
+  return true;
+}
+
+bool bq27441_SaveBatteryId(const char * batteryId)
+{
+  BatteryRecord record;
+  memset(&record, 0, sizeof(record));
+  strncpy(record.name, batteryId, sizeof(record.name) - 1);
+  record.crc = crc32(record.name, sizeof(record.name));
+
+  BatteryRecord saved;
+  EEPROM.begin(GI_EEPROM_SIZE);
+  EEPROM.get(BATTERY_EEPROM_ADDR, saved);
+  bool success = true;
+  if (memcmp(&saved, &record, sizeof(record)) != 0) {
+    EEPROM.put(BATTERY_EEPROM_ADDR, record);
+    success = EEPROM.commit();
+  }
+  EEPROM.end();
+  return success;
+}
+
+bool bq27441_LoadBatteryId(char * batteryId, size_t size)
+{
+  BatteryRecord record;
+  EEPROM.begin(GI_EEPROM_SIZE);
+  EEPROM.get(BATTERY_EEPROM_ADDR, record);
+  EEPROM.end();
+  record.name[sizeof(record.name) - 1] = 0;
+  if (record.crc != crc32(record.name, sizeof(record.name)) || record.name[0] == 0)
+    return false;
+  strncpy(batteryId, record.name, size - 1);
+  batteryId[size - 1] = 0;
+  return true;
+}
+
+// Fingerprint of the Data Memory parameters an image sets. Qmax, R_a and Update Status are
+// left out: the gauge updates them as it learns, and they are not rewritten if the rest matches.
+static uint32 fingerprint(uint16 dmCode, uint16 designCapacity, uint16 designEnergy,
+                          uint16 taperRate, uint16 terminateVoltage)
+{
+  uint16 parameters[] = { dmCode, designCapacity, designEnergy, taperRate, terminateVoltage };
+  return crc32(parameters, sizeof(parameters));
+}
 
+// Fingerprint of the gauge Data Memory, the gauge must be in config mode
+static uint32 gaugeFingerprint(BQ27441 & lipo)
+{
+  // Energy, taper rate and terminate voltage share a STATE block, it is loaded once
+  return fingerprint(lipo.dmCode(), lipo.capacity(DESIGN), lipo.designEnergy(),
+                     lipo.taperRate(), lipo.terminateVoltage());
+}
 
 //
 //  Additional BQ27441 Data Memory Access functions not available in Sparkfun library,
 //  And we can also control the enter and exit of the configuration mode
 //
-bool bq27441_InitParameters(BQ27441 lipo, int terminateVoltage) 
+// Fuel gauge initialization steps, advanced by bq27441_PollInit()
+enum InitStep { INIT_IDLE, INIT_WAIT_INITCOMP, INIT_ENTER_CONFIG, INIT_EXIT_CONFIG };
+static InitStep init_step = INIT_IDLE;
+static int init_terminate_voltage;
+static GoldenImage init_image;
+static bool init_success;
+static bool init_skipped;
+
+// Write the golden image into Data Memory, the gauge must be in config mode
+static bool writeParameters(BQ27441 & lipo, int terminateVoltage, GoldenImage & image)
 {
-  while ( !(lipo.status() & BQ27441_STATUS_INITCOMP) ) { delay(1); }
-  lipo.enterConfig();
-  bool success = lipo.setCapacity(design_capacity,design_energy);
-  success = success && lipo.setTaperRate(taper_rate);
+  lipo.beginStagedWrites();                     // One load and one commit per Data Memory block
+  bool success = lipo.setCapacity(image.designCapacity, image.designEnergy);
+  success = success && lipo.setTaperRate(image.taperRate);
   success = success && lipo.setTerminateVoltage(terminateVoltage);
-  if (saved_qmax == -1) {
+  if (image.qmax == GI_NO_QMAX) {
     // No golden image. Do a learning cycle.
     success = success && lipo.setUpdateStatusReg(0x03);   // Fast updates of Qmax and R_a Table
     #ifdef DEV_MODE
@@ -110,32 +239,94 @@ bool bq27441_InitParameters(BQ27441 lipo, int terminateVoltage)
     #endif 
   }
   else {
-    success = success && lipo.setQmax(saved_qmax);
-    success = success && lipo.setRaTable(saved_ra_table);
+    success = success && lipo.setQmax(image.qmax);
     #ifdef DEV_MODE
     success = success && lipo.setUpdateStatusReg(0x03);    // Dev Mode: Fast updates
     Serial.print(F("Fast Updates. "));
     #else
     success = success && lipo.setUpdateStatusReg(0x80);    // Production: Sealed the Fuel Gauge memory
     #endif
+    // R_a RAM is a different class, write it after all STATE parameters are staged
+    success = success && lipo.setRaTable(image.raTable);
   }
-  lipo.exitConfig(true);     // resim
-  return success;
+  return lipo.commitStagedWrites() && success;
 }
 
-uint16 bq27441_ReadQmax(BQ27441 lipo) 
+bool bq27441_BeginInit(BQ27441 & lipo, int terminateVoltage, const GoldenImage & image)
 {
-  lipo.enterConfig();
-  uint16 qmax = lipo.Qmax();
-  lipo.exitConfig(false);    // no resim
-  return qmax;
+  init_terminate_voltage = terminateVoltage;
+  init_image = image;
+  bq27441_LoadLearned(init_image);    // Learned parameters are closer to the battery than the image
+  init_success = true;
+  init_skipped = false;
+  init_step = INIT_WAIT_INITCOMP;
+  return lipo.beginWaitInit();
 }
 
-bool bq27441_ReadRaTable(BQ27441 lipo, uint16 * raTable)
+poll_result bq27441_PollInit(BQ27441 & lipo)
 {
-  lipo.enterConfig();
-  lipo.RaTable(raTable);
-  lipo.exitConfig(false);    // no resim
-  return true;
+  poll_result result = lipo.poll();
+  if (result == POLL_ERROR) {
+    if (init_step == INIT_ENTER_CONFIG)
+      lipo.beginExitConfig(false);    // Give up config mode, no resim
+    init_step = INIT_IDLE;
+  }
+  if (result != POLL_DONE)
+    return result;
+
+  switch (init_step) {
+    case INIT_WAIT_INITCOMP:
+      init_step = INIT_ENTER_CONFIG;
+      if (lipo.beginEnterConfig())
+        return POLL_PENDING;
+      break;
+
+    case INIT_ENTER_CONFIG:
+      // Nothing to write, and nothing to resim, if the gauge already holds the image
+      init_skipped = (gaugeFingerprint(lipo) ==
+                      fingerprint(GI_DM_CODE, init_image.designCapacity, init_image.designEnergy,
+                                  init_image.taperRate, init_terminate_voltage));
+      if (!init_skipped)
+        init_success = writeParameters(lipo, init_terminate_voltage, init_image);
+      init_success = init_success && (lipo.lastError() == BQ27441_OK);
+      init_step = INIT_EXIT_CONFIG;
+      if (lipo.beginExitConfig(!init_skipped))
+        return POLL_PENDING;
+      break;
+
+    case INIT_EXIT_CONFIG:
+      init_step = INIT_IDLE;
+      return init_success ? POLL_DONE : POLL_ERROR;
+
+    case INIT_IDLE:
+      return POLL_DONE;
+  }
+  // Failed to send a command
+  init_step = INIT_IDLE;
+  return POLL_ERROR;
+}
+
+bool bq27441_InitSkipped()
+{
+  return init_skipped;
 }
 
+bool bq27441_InitParameters(BQ27441 & lipo, int terminateVoltage, const GoldenImage & image)
+{
+  bq27441_BeginInit(lipo, terminateVoltage, image);
+  poll_result result;
+  while ( (result = bq27441_PollInit(lipo)) == POLL_PENDING ) { delay(1); }
+  return (result == POLL_DONE);
+}
+
+uint16 bq27441_ReadQmax(BQ27441 & lipo) 
+{
+  BQ27441::ConfigSession config(lipo);    // no resim
+  return lipo.Qmax();
+}
+
+bool bq27441_ReadRaTable(BQ27441 & lipo, uint16 * raTable)
+{
+  BQ27441::ConfigSession config(lipo);    // no resim
+  return config.active() && lipo.RaTable(raTable);
+}
@@ -3,8 +3,51 @@
 
 #include <SparkFunBQ27441.h>
 
-bool bq27441_InitParameters(BQ27441 lipo, int terminateVoltage);
-uint16 bq27441_ReadQmax(BQ27441 lipo);
-bool bq27441_ReadRaTable(BQ27441 lipo, uint16 * ra_table);
+// A battery golden image: the Data Memory parameters written to the gauge after a POR
+#define GI_NO_QMAX 0xFFFF       // qmax of an image without battery data, do a learning cycle
+struct GoldenImage {
+  char   name[20];              // Battery ID
+  uint16 designCapacity;        // (mAh)
+  uint16 designEnergy;          // (mWh) = Capacity * Nominal Voltage
+  uint16 taperRate;             // (0.1 Hr) = Capacity / Taper current
+  uint16 qmax;                  // GI_NO_QMAX if battery data not available
+  uint16 raTable[15];
+};
+
+// Select the golden image of a battery by its ID, or by its design capacity if batteryId is
+// NULL or unknown. Without a saved image, a learning cycle image is made up from the capacity.
+// Returns true if a saved image was found.
+bool bq27441_SelectImage(GoldenImage & image, const char * batteryId, uint16 designCapacity);
+
+// Learned parameters: Qmax and R_a Table the gauge has learned for a battery, kept in EEPROM.
+// bq27441_SaveLearned() only writes when they changed. bq27441_BeginInit() writes them in place
+// of the image's saved values, if they were learned on a battery of the same ID and capacity.
+bool bq27441_SaveLearned(const GoldenImage & image, uint16 qmax, const uint16 * raTable);
+bool bq27441_LoadLearned(GoldenImage & image);
+
+// bq27441_SaveLearned() once per gauge update: on a rising edge of QMAX_UP or RES_UP in the
+// CONTROL_STATUS bits status, against those of the last call kept in RTC memory. The bits stay
+// set and R_a keeps moving while the gauge learns, saving on every wake would wear the flash.
+// True if there was nothing to save.
+bool bq27441_SaveLearnedOnUpdate(const GoldenImage & image, uint16 status, uint16 qmax,
+                                 const uint16 * raTable);
+
+// Battery ID kept in EEPROM, so a new battery type can be set without a new build.
+// bq27441_LoadBatteryId() returns false if none was saved.
+bool bq27441_SaveBatteryId(const char * batteryId);
+bool bq27441_LoadBatteryId(char * batteryId, size_t size);
+
+// Non-blocking initialization: wait for INITCOMP, enter config mode, write the golden image
+// and exit with a resim. Call bq27441_PollInit() until it stops returning POLL_PENDING.
+// The write and the resim are skipped if the gauge already holds the image.
+bool bq27441_BeginInit(BQ27441 & lipo, int terminateVoltage, const GoldenImage & image);
+poll_result bq27441_PollInit(BQ27441 & lipo);
+bool bq27441_InitSkipped();     // Last initialization found the image in place
+
+// Blocking helpers. The readers open their own BQ27441::ConfigSession, or share the
+// caller's if one is open
+bool bq27441_InitParameters(BQ27441 & lipo, int terminateVoltage, const GoldenImage & image);
+uint16 bq27441_ReadQmax(BQ27441 & lipo);
+bool bq27441_ReadRaTable(BQ27441 & lipo, uint16 * ra_table);
 
 #endif //BQ27441GI_h
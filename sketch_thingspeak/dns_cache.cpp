@@ -0,0 +1,39 @@
+/*
+ * DNS Cache
+ * Last resolved server address in RTC memory, see dns_cache.h.
+ */
+
+#include "dns_cache.h"
+#include "rtc_memory.h"
+
+// Saved in RTC memory at each lookup
+struct DnsRecord {
+  uint32 hostCrc;       // crc32() of the host name, a record for another host is not used
+  uint32 address;       // IPv4 address
+  uint32 clockMs;       // rtcClock() of the lookup
+};
+
+bool dnsCached(const char * host, IPAddress & address, uint32 ttl)
+{
+  DnsRecord record;
+  if (!rtcLoad(RTC_BLOCK_DNS, &record, sizeof(record)))
+    return false;
+  if (record.hostCrc != crc32(host, strlen(host)) || record.address == 0)
+    return false;
+  if ((rtcClock() - record.clockMs) / 1000 >= ttl)
+    return false;
+  address = record.address;
+  return true;
+}
+
+bool dnsLookup(const char * host, IPAddress & address)
+{
+  if (!WiFi.hostByName(host, address))
+    return false;
+  DnsRecord record;
+  record.hostCrc = crc32(host, strlen(host));
+  record.address = (uint32)address;
+  record.clockMs = rtcClock();
+  rtcSave(RTC_BLOCK_DNS, &record, sizeof(record));
+  return true;
+}
@@ -0,0 +1,16 @@
+#ifndef dns_cache_h
+#define dns_cache_h
+
+#include <ESP8266WiFi.h>
+
+// Server address kept in RTC memory, so a wake can connect without waiting for a DNS
+// lookup first. The address is looked up again when it is older than its TTL, or when
+// a connect to it failed.
+
+// Cached address of host, false if there is none younger than ttl (s)
+bool dnsCached(const char * host, IPAddress & address, uint32 ttl);
+
+// DNS lookup of host, the address found replaces the cached one
+bool dnsLookup(const char * host, IPAddress & address);
+
+#endif //dns_cache_h
@@ -0,0 +1,138 @@
+/*
+ * HTTP Response Reader
+ * Status line, the headers that frame the body, and the body, see http_response.h.
+ */
+
+#include "http_response.h"
+
+#define HTTP_LINE_MAX 128     // Longer header lines are cut, only their start is looked at
+
+struct HttpReader {
+  WiFiClient & client;
+  unsigned long start;        // millis() at the start of the response
+  uint32 timeoutMs;
+};
+
+// Next byte of the response, -1 on a timeout or once the connection is closed and drained
+static int readByte(HttpReader & reader)
+{
+  while (!reader.client.available()) {
+    if (!reader.client.connected() || millis() - reader.start > reader.timeoutMs)
+      return -1;
+    delay(1);                 // Let the WiFi stack run
+  }
+  return reader.client.read();
+}
+
+// One line without its CRLF
+static bool readLine(HttpReader & reader, char * line)
+{
+  size_t length = 0;
+  for (;;) {
+    int c = readByte(reader);
+    if (c < 0)
+      return false;
+    if (c == '\n')
+      break;
+    if (c != '\r' && length < HTTP_LINE_MAX - 1)
+      line[length++] = c;
+  }
+  line[length] = 0;
+  return true;
+}
+
+static bool readBody(HttpReader & reader, uint32 length, PayloadBuffer * body)
+{
+  for (; length > 0; length--) {
+    int c = readByte(reader);
+    if (c < 0)
+      return false;
+    if (body)
+      body->write((uint8)c);
+  }
+  return true;
+}
+
+// Value of a "Name: value" header line, NULL if the line is another header
+static const char * headerValue(const char * line, const char * name)
+{
+  size_t length = strlen(name);
+  if (strncasecmp(line, name, length) != 0 || line[length] != ':')
+    return NULL;
+  const char * value = line + length + 1;
+  while (*value == ' ')
+    value++;
+  return value;
+}
+
+bool httpReadResponse(WiFiClient & client, HttpResponse & response, PayloadBuffer * body, uint32 timeoutMs)
+{
+  HttpReader reader = { client, millis(), timeoutMs };
+  char line[HTTP_LINE_MAX];
+  response.status = 0;
+  response.keepAlive = false;
+
+  // Status line, HTTP/1.1 keeps the connection unless told otherwise
+  if (!readLine(reader, line) || strncmp(line, "HTTP/1.", 7) != 0)
+    return false;
+  response.keepAlive = (line[7] == '1');
+  response.status = atoi(line + 9);
+
+  bool chunked = false;
+  bool framed = false;        // The body length is known, Content-Length or chunked
+  uint32 contentLength = 0;
+  for (;;) {
+    if (!readLine(reader, line))
+      return false;
+    if (line[0] == 0)
+      break;                  // End of the headers
+    const char * value;
+    if ((value = headerValue(line, "Content-Length")) != NULL) {
+      contentLength = strtoul(value, NULL, 10);
+      framed = true;
+    }
+    else if ((value = headerValue(line, "Transfer-Encoding")) != NULL) {
+      chunked = (strncasecmp(value, "chunked", 7) == 0);
+      framed = framed || chunked;
+    }
+    else if ((value = headerValue(line, "Connection")) != NULL) {
+      if (strncasecmp(value, "close", 5) == 0)
+        response.keepAlive = false;
+      else if (strncasecmp(value, "keep-alive", 10) == 0)
+        response.keepAlive = true;
+    }
+  }
+
+  // No body for 1xx, 204 and 304
+  if (response.status < 200 || response.status == 204 || response.status == 304)
+    return true;
+
+  if (chunked) {
+    for (;;) {
+      if (!readLine(reader, line))
+        return false;
+      uint32 size = strtoul(line, NULL, 16);
+      if (size == 0)
+        break;
+      if (!readBody(reader, size, body) || !readLine(reader, line))
+        return false;         // Chunk data and its CRLF
+    }
+    do {                      // Trailer, up to the blank line
+      if (!readLine(reader, line))
+        return false;
+    } while (line[0] != 0);
+    return true;
+  }
+
+  if (framed)
+    return readBody(reader, contentLength, body);
+
+  // Body up to the close, the connection can't be used again
+  response.keepAlive = false;
+  int c;
+  while ((c = readByte(reader)) >= 0) {
+    if (body)
+      body->write((uint8)c);
+  }
+  return true;
+}
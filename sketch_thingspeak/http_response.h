@@ -0,0 +1,19 @@
+#ifndef http_response_h
+#define http_response_h
+
+#include <ESP8266WiFi.h>
+#include "payload_buffer.h"
+
+// HTTP/1.1 response reader. The whole response is consumed (Content-Length, chunked, or
+// up to the close), so a connection that is kept open starts clean for the next request.
+struct HttpResponse {
+  int status;           // Status code, 0 if no status line was read
+  bool keepAlive;       // The server keeps the connection open after this response
+};
+
+// Read one response within timeoutMs. The body goes into body, truncated to its capacity,
+// or is discarded if body is NULL. false on a timeout, a dropped connection or a malformed
+// response.
+bool httpReadResponse(WiFiClient & client, HttpResponse & response, PayloadBuffer * body, uint32 timeoutMs);
+
+#endif //http_response_h
@@ -0,0 +1,30 @@
+/*
+ * Fixed Payload Buffer
+ * Print target over a caller-owned buffer, see payload_buffer.h.
+ */
+
+#include "payload_buffer.h"
+
+PayloadBuffer::PayloadBuffer(char * buffer, size_t capacity)
+  : _buffer(buffer), _capacity(capacity), _length(0), _truncated(false)
+{
+  _buffer[0] = 0;
+}
+
+size_t PayloadBuffer::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t PayloadBuffer::write(const uint8_t * data, size_t size)
+{
+  size_t room = _capacity - 1 - _length;
+  if (size > room) {
+    size = room;
+    _truncated = true;
+  }
+  memcpy(_buffer + _length, data, size);
+  _length += size;
+  _buffer[_length] = 0;
+  return size;
+}
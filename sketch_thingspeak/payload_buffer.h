@@ -0,0 +1,29 @@
+#ifndef payload_buffer_h
+#define payload_buffer_h
+
+#include <Arduino.h>
+
+// Text built in place in a fixed buffer, without heap allocations. It is a Print, so the
+// print() overloads format numbers and flash strings straight into the buffer. What does
+// not fit is dropped, and truncated() reports it.
+class PayloadBuffer : public Print {
+public:
+  PayloadBuffer(char * buffer, size_t capacity);
+  template <size_t N> PayloadBuffer(char (& buffer)[N]) : PayloadBuffer(buffer, N) {}
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t * data, size_t size) override;
+  using Print::write;
+
+  const char * c_str() const { return _buffer; }
+  size_t length() const { return _length; }
+  bool truncated() const { return _truncated; }
+
+private:
+  char * _buffer;
+  size_t _capacity;     // Including the terminating 0
+  size_t _length;
+  bool _truncated;
+};
+
+#endif //payload_buffer_h
@@ -0,0 +1,51 @@
+/*
+ * Report by Exception
+ * Deadbands around the last reported sample, see report_deadband.h.
+ */
+
+#include "report_deadband.h"
+#include "rtc_memory.h"
+
+// Saved in RTC memory at each report
+struct ReportRecord {
+  LogSample sample;     // Last reported readings
+  uint32 clockMs;       // rtcClock() of the report
+};
+
+static bool outside(int32_t value, int32_t reported, uint32 deadband)
+{
+  return (uint32)abs(value - reported) > deadband;
+}
+
+bool reportDue(const LogSample & sample, const ReportDeadband & deadband)
+{
+  ReportRecord record;
+  if (!rtcLoad(RTC_BLOCK_REPORT, &record, sizeof(record)))
+    return true;
+  if ((rtcClock() - record.clockMs) / 1000 >= deadband.heartbeat)
+    return true;
+
+  const LogSample & last = record.sample;
+  if (sample.valid != last.valid)
+    return true;
+  if (outside(sample.adcVoltage, last.adcVoltage, deadband.voltage))
+    return true;
+  if ((sample.valid & LOG_BME280) &&
+      (outside(sample.temperature, last.temperature, deadband.temperature) ||
+       outside(sample.humidity, last.humidity, deadband.humidity) ||
+       outside(sample.pressure, last.pressure, deadband.pressure)))
+    return true;
+  if ((sample.valid & LOG_GAUGE) &&
+      (outside(sample.lipoVoltage, last.lipoVoltage, deadband.voltage) ||
+       outside(sample.lipoSoc, last.lipoSoc, deadband.soc)))
+    return true;
+  return false;
+}
+
+bool reportSent(const LogSample & sample)
+{
+  ReportRecord record;
+  record.sample = sample;
+  record.clockMs = rtcClock();
+  return rtcSave(RTC_BLOCK_REPORT, &record, sizeof(record));
+}
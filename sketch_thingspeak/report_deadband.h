@@ -0,0 +1,26 @@
+#ifndef report_deadband_h
+#define report_deadband_h
+
+#include <Arduino.h>
+#include "sample_log.h"
+
+// Report by exception: a sample is only reported when a reading moved out of its deadband
+// around the last reported value, or when the heartbeat ran out. The last report is kept
+// in RTC memory, so it is compared across deep-sleep.
+struct ReportDeadband {
+  uint16 voltage;       // (mV) ADC and gauge voltage
+  uint16 temperature;   // (0.01 C)
+  uint16 humidity;      // (0.01 %RH)
+  uint16 pressure;      // (Pa)
+  uint8 soc;            // (%)
+  uint32 heartbeat;     // (s) Longest time between two reports
+};
+
+// The sample has to be reported: first one since power-on, a sensor came or went, a reading
+// moved more than its deadband, or the heartbeat ran out
+bool reportDue(const LogSample & sample, const ReportDeadband & deadband);
+
+// Record a sample as reported, the next ones are compared with it
+bool reportSent(const LogSample & sample);
+
+#endif //report_deadband_h
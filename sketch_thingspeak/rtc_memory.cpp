@@ -0,0 +1,63 @@
+/*
+ * ESP8266 RTC User Memory Records
+ * Small CRC-protected records that survive deep-sleep, see rtc_memory.h for the block map.
+ */
+
+#include "rtc_memory.h"
+extern "C" {
+#include "user_interface.h"
+}
+
+// CRC-32 (IEEE 802.3), bitwise to keep it out of flash tables
+uint32 crc32(const void * data, size_t length, uint32 crc)
+{
+  const uint8 * p = (const uint8 *)data;
+  crc = ~crc;
+  while (length--) {
+    crc ^= *p++;
+    for (int i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+// Saved in RTC memory when going to sleep
+struct ClockRecord {
+  uint32 clockMs;       // rtcClock() at sleep
+  uint32 timerMs;       // Deep-sleep timer that was set (0 = until RST)
+};
+
+uint32 rtcClock()
+{
+  ClockRecord record;
+  if (!rtcLoad(RTC_BLOCK_CLOCK, &record, sizeof(record)))
+    return millis();              // Power-on, or the record was lost
+  if (ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE)
+    return record.clockMs + record.timerMs + millis();
+  return record.clockMs + millis();
+}
+
+bool rtcClockSleep(uint32 timer)
+{
+  ClockRecord record;
+  record.clockMs = rtcClock();
+  record.timerMs = timer / 1000;
+  return rtcSave(RTC_BLOCK_CLOCK, &record, sizeof(record));
+}
+
+bool rtcLoad(uint8 block, void * data, size_t size)
+{
+  uint32 crc;
+  if (!ESP.rtcUserMemoryRead(block, &crc, sizeof(crc)))
+    return false;
+  if (!ESP.rtcUserMemoryRead(block + 1, (uint32 *)data, size))
+    return false;
+  return (crc == crc32(data, size));
+}
+
+bool rtcSave(uint8 block, const void * data, size_t size)
+{
+  uint32 crc = crc32(data, size);
+  return ESP.rtcUserMemoryWrite(block, &crc, sizeof(crc)) &&
+         ESP.rtcUserMemoryWrite(block + 1, (uint32 *)data, size);
+}
@@ -0,0 +1,33 @@
+#ifndef rtc_memory_h
+#define rtc_memory_h
+
+#include <Arduino.h>
+
+// ESP8266 RTC user memory: 128 blocks of 4 bytes, kept through deep-sleep but lost on
+// power loss. Each record is stored as a CRC32 block followed by the record data, so
+// a record is only loaded back if it survived intact.
+// Record structs must be 4-byte aligned (use uint32 members or pad).
+//
+// Block map (first block of each record):
+#define RTC_BLOCK_WAKE      0     // wake_policy.cpp: 5 blocks
+#define RTC_BLOCK_CLOCK     5     // rtc_memory.cpp: 3 blocks
+#define RTC_BLOCK_LOG       8     // sample_log.cpp: 67 blocks
+#define RTC_BLOCK_REPORT    76    // report_deadband.cpp: 6 blocks
+#define RTC_BLOCK_DNS       83    // dns_cache.cpp: 4 blocks
+#define RTC_BLOCK_WIFI      88    // wifi_lease.cpp: 9 blocks
+#define RTC_BLOCK_LEARNED   97    // bq27441gi.cpp: 2 blocks
+
+bool rtcLoad(uint8 block, void * data, size_t size);
+bool rtcSave(uint8 block, const void * data, size_t size);
+uint32 crc32(const void * data, size_t length, uint32 crc = 0);
+
+// Time (ms) since power-on, kept through deep-sleep. The RTC tick counter can't measure
+// a sleep, it restarts with the reset that ends it. Instead a wake starts from the clock
+// at sleep plus the deep-sleep timer that was set (see rtcClockSleep()), and adds millis().
+// An early wake (gauge RST) counts the whole timer, so ages only ever run ahead.
+uint32 rtcClock();
+
+// Record the clock and the deep-sleep timer (us) that is about to be set
+bool rtcClockSleep(uint32 timer);
+
+#endif //rtc_memory_h
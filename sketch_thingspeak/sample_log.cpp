@@ -0,0 +1,81 @@
+/*
+ * RTC Sample Log
+ * Ring of compact samples kept through deep-sleep, see sample_log.h.
+ */
+
+#include "sample_log.h"
+#include "rtc_memory.h"
+
+// Saved in RTC memory after every change
+struct LogRing {
+  uint32 clockMs;       // rtcClock() of the newest sample
+  uint8 first;          // Oldest sample
+  uint8 count;
+  uint16 reserved;
+  LogSample samples[LOG_CAPACITY];
+};
+
+static LogRing ring;
+
+// (s) Since the newest sample, 0 if the clock went back (a reset that lost the clock)
+static uint32 sinceNewest()
+{
+  int32_t ms = rtcClock() - ring.clockMs;
+  return (ms > 0) ? ms / 1000 : 0;
+}
+
+bool logLoad()
+{
+  if (rtcLoad(RTC_BLOCK_LOG, &ring, sizeof(ring)) &&
+      ring.first < LOG_CAPACITY && ring.count <= LOG_CAPACITY)
+    return true;
+  memset(&ring, 0, sizeof(ring));
+  return false;
+}
+
+bool logAppend(LogSample sample)
+{
+  // The time slept is the deep-sleep timers that were set, see rtcClock()
+  sample.deltaSec = min(sinceNewest(), (uint32)0xFFFF);
+  ring.clockMs = rtcClock();
+
+  if (ring.count == LOG_CAPACITY) {
+    ring.first = (ring.first + 1) % LOG_CAPACITY;
+    ring.count--;
+  }
+  ring.samples[(ring.first + ring.count) % LOG_CAPACITY] = sample;
+  ring.count++;
+  return rtcSave(RTC_BLOCK_LOG, &ring, sizeof(ring));
+}
+
+bool logClear()
+{
+  ring.first = 0;
+  ring.count = 0;
+  return rtcSave(RTC_BLOCK_LOG, &ring, sizeof(ring));
+}
+
+uint8 logCount()
+{
+  return ring.count;
+}
+
+const LogSample & logSample(uint8 i)
+{
+  return ring.samples[(ring.first + i) % LOG_CAPACITY];
+}
+
+bool logUploadDue(uint8 batchSize)
+{
+  return ring.count + 1 >= batchSize;
+}
+
+uint32 logAge()
+{
+  if (ring.count == 0)
+    return 0;
+  uint32 seconds = sinceNewest();
+  for (uint8 i = 1; i < ring.count; i++)
+    seconds += logSample(i).deltaSec;
+  return seconds;
+}
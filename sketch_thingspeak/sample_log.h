@@ -0,0 +1,48 @@
+#ifndef sample_log_h
+#define sample_log_h
+
+#include <Arduino.h>
+
+// Samples kept in RTC memory between wakes, so several can be uploaded in one connection.
+// The log is a ring: when it is full the oldest sample is dropped. Each sample records the
+// time since the previous one, on the clock kept through deep-sleep (see rtcClock()).
+#define LOG_CAPACITY 16
+
+// LogSample::valid bits
+#define LOG_BME280  0x01    // temperature, humidity and pressure were read
+#define LOG_GAUGE   0x02    // lipoVoltage and lipoSoc were read
+
+// One compact sample, 16 bytes
+struct LogSample {
+  uint16 deltaSec;        // (s) Since the previous sample, 0 for the first one after power-on
+  uint16 adcVoltage;      // (mV)
+  int16_t temperature;    // (0.01 C)
+  uint16 humidity;        // (0.01 %RH)
+  uint32 pressure;        // (Pa) Reduced to sea level
+  uint16 lipoVoltage;     // (mV)
+  uint8 lipoSoc;          // (%)
+  uint8 valid;            // LOG_BME280, LOG_GAUGE
+};
+
+// Load the log from RTC memory, false (and an empty log) if it was lost or corrupted
+bool logLoad();
+
+// Timestamp a sample and add it to the log, dropping the oldest one if it is full
+bool logAppend(LogSample sample);
+
+// Forget the samples once they are uploaded, the clock of the newest one is kept
+bool logClear();
+
+// Number of samples in the log
+uint8 logCount();
+
+// Sample i of the log, the oldest is 0
+const LogSample & logSample(uint8 i);
+
+// The sample of the next wake completes a batch of batchSize samples
+bool logUploadDue(uint8 batchSize);
+
+// (s) Time since the oldest sample of the log was taken, 0 if it is empty
+uint32 logAge();
+
+#endif //sample_log_h
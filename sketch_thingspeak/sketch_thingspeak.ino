@@ -31,38 +31,102 @@ Deep-Sleep:
 */
 
 #include <ESP8266WiFi.h>
-#include <Adafruit_Sensor.h>
-#include <Adafruit_BME280.h>
 #include <SparkFunBQ27441.h>
+#include "adc_battery.h"
+#include "bme280_forced.h"
 #include "bq27441gi.h"
+#include "dns_cache.h"
+#include "http_response.h"
+#include "payload_buffer.h"
+#include "report_deadband.h"
+#include "sample_log.h"
+#include "sleep_schedule.h"
+#include "wake_policy.h"
+#include "wifi_lease.h"
 
 // Compiler directives, comment out to disable
 #define USE_SERIAL Serial               // Valid options: Serial and Serial1
 #define DEBUG_FAST_UPDATE                 // Debug mode for fastest updates and battery discharge
 #define BQ27441_FUEL_GAUGE              // BQ27441 Impedance Track Fuel Gauge
 #define I2C_BME280_ADDR 0x76            // BME280 I2C address
+//#define BQ27441_GPOUT_WAKE              // BQ27441 GPOUT wired to RST wakes us when SoC moves
+//#define BQ27441_BUS_PROFILE             // Report the Fuel Gauge I2C traffic of each wake in the status
+//#define RTC_SAMPLE_BATCH 10             // Keep samples in RTC memory, radio on every 10th wake only
+//#define REPORT_BY_EXCEPTION             // Only report readings that moved out of their deadband
+//#define ADAPTIVE_SLEEP                  // Deep-sleep interval from the gauge and a battery-life target
 
 // To read a max 4.2V from V(bat), a voltage divider is used to drop down to Vref=1.06V for the ADC
-const float volt_div_const = 4.45*1.06/1.023; // multiplier = Vin_max*Vref/1.023 (mV)
-                                              // WeMos BatShield: (350KΩ+100KΩ) Vin = 4.49
-                                              // LM3671 Shield:   (340KΩ+100KΩ) Vin = 4.45
+// multiplier = Vin_max*Vref/1.023 (mV) = 4.45*1.06/1.023 = 4717/1023
+//   WeMos BatShield: (350KΩ+100KΩ) Vin = 4.49
+//   LM3671 Shield:   (340KΩ+100KΩ) Vin = 4.45
+// 32 samples, the 8 lowest and 8 highest dropped as outliers, the middle 16 averaged
+const AdcConfig adc_config = { 32, 8, 4717, 1023 };
+int adcBattery = -1;                          // (mV) Read in setup() with the radio off, -1 once used
 
 // BQ27441 settings
 // Note: there is a small 20mV (@100mA) to 50mV (@1A) dropout between V(bat) and V(A0)
 const int terminate_voltage = 3000;  // (mV) Host system lowest operating voltage 
+// The golden image is chosen at runtime (see selectBatteryImage()), these are the fallback
+const char* battery_id = "Samsung_30Q-Pink"; // Golden image to use (see bq27441gi.cpp), NULL to select by capacity
+const uint16 battery_capacity = 3000;        // (mAh) Selects the image if battery_id is NULL or unknown
+const unsigned long battery_id_window = 2000; // (ms) After a power-on, wait for "battery=<ID>" on serial
+const uint32 lipo_i2c_timeout = 5000;  // (us) Give up on a gauge read after this long
+
+// Deep-sleep wake policy (see wake_policy.h)
+#ifdef BQ27441_GPOUT_WAKE
+// Wake on every 1% SoC change, and at least every 30 min as a heartbeat
+const WakePolicy wake_policy = { true, SOC_INT, 1, 1800 * 1000000, WAKE_NO_PIN };
+#else
+const WakePolicy wake_policy = { false, SOC_INT, 1, 0, WAKE_NO_PIN };
+#endif
+WakeSource wakeReason;
+bool radioWake = true;               // WiFi can be used, false on the radio-off wakes (see nextWakeRadio())
+#if defined(REPORT_BY_EXCEPTION) && !defined(RTC_SAMPLE_BATCH)
+bool reportRestart = false;          // Restarted with the radio for a report found due without it
+#endif
+
+#if defined(ADAPTIVE_SLEEP) && !defined(BQ27441_FUEL_GAUGE)
+#error ADAPTIVE_SLEEP needs the BQ27441 Fuel Gauge
+#endif
+
+#ifdef RTC_SAMPLE_BATCH
+#if RTC_SAMPLE_BATCH > LOG_CAPACITY
+#error RTC_SAMPLE_BATCH is larger than the RTC sample log
+#endif
+#endif
 
 // Wi-Fi Settings
 const char* ssid     = "San Leandro";      // your wireless network name (SSID)
 const char* password = "nintendo";         // your Wi-Fi network password
 const unsigned long wifi_connect_timeout = 10 * 1000;  // 10 seconds
+const unsigned long wifi_lease_timeout = 2 * 1000;     // Scan again if the last AP isn't joined in 2 sec
+const uint32 wifi_lease_ttl = 3600;                    // (s) Renew the DHCP lease every hour
+bool wifiFast = false;                 // Joining the AP of the last wake (see wifi_lease.h)
+enum UploadStatus { UPLOAD_SENT, UPLOAD_RETRY, UPLOAD_LATER, UPLOAD_REJECTED };
 
 // ThingSpeak Settings
 const int channel_id     = 293299;                // Channel ID for ThingSpeak 
-const String write_api_key = "QPRPTUT1SYYLEEDS";  // write API key for ThingSpeak Channel
+const char write_api_key[] = "QPRPTUT1SYYLEEDS"; // write API key for ThingSpeak Channel
 const char* api_endpoint = "api.thingspeak.com";  // URL
+const uint32 http_response_timeout = 2000;        // (ms) Wait for the reply to an update
+const uint32 upload_backoff = 250;                // (ms) First retry delay, doubled on each retry
+const uint32 upload_budget = 5000;                // (ms) Retries end within 5 sec of the first post
+const uint32 dns_ttl = 3600;                      // (s) Look api_endpoint up again after 1 hour
 const int upload_interval    =  30 * 1000;        // External power: Post data every 30 sec
-const uint32 sleep_timer     = 060 * 1000000;     // Normal battery: Post data every = 60 sec
+const uint32 sleep_timer     =  60 * 1000000;     // Normal battery: Post data every = 60 sec
 const uint32 hibernate_timer = 150 * 1000000;     // Hibernate: Post data every = 2.5 min
+#ifdef ADAPTIVE_SLEEP
+// On battery, make the charge left last 90 days, posting between every 30 sec and every
+// 30 min. Deep-sleep draws about 60uA: ESP8266, regulator, dividers and the gauge.
+const SleepBudget sleep_budget = { 90, 30, 1800, 60 };
+#endif
+uint32 adaptiveTimer = 0;                         // (us) From the gauge in measureData(), 0 = none
+#ifdef REPORT_BY_EXCEPTION
+// Report when a reading moved more than 20mV, 0.5C, 2%RH, 1hPa or 1% SoC since the last
+// report, and at least every 30 min. With RTC_SAMPLE_BATCH, reported means logged.
+// Without it the wakes are radio-off, and restart with the radio when a report is due.
+const ReportDeadband report_deadband = { 20, 50, 200, 100, 1, 1800 };
+#endif
 
 // ESP8266 settings
 const int recharge_voltage  = 4130;  // (mV) Recharging threshold, above -> battery full/charging 
@@ -74,204 +138,830 @@ Battery wemosBattery;
 
 // BME280 settings
 const float thing_altitude = 30;     // My altitude (meters)
+#ifdef I2C_BME280_ADDR
+// Weather monitoring: one forced conversion per wake, no oversampling (< 10ms)
+const Bme280Config bme_config = { I2C_BME280_ADDR, BME280_X1, BME280_X1, BME280_X1 };
+#endif
+
+// Payload buffers, no heap allocations. ThingSpeak keeps 255 characters of status, the
+// body holds the fields of every sample (checked where it is built, see bulkBody()), and
+// the request headers go in front of it (see postData()). Without RTC_SAMPLE_BATCH the
+// sample log keeps the updates that failed, so the body has to hold it all the same.
+#define STATUS_CAPACITY 256
+#define HEADER_CAPACITY 256
+#define BODY_CAPACITY 2560
 
 // Initialize class objects
 WiFiClient client;
-#ifdef I2C_BME280_ADDR
-Adafruit_BME280 bme; 
-#endif
+LogSample thingSample;               // Latest readings, set by measureData()
+char thingStatus[STATUS_CAPACITY];   // ThingSpeak status of the latest readings
+char thingRequest[HEADER_CAPACITY + BODY_CAPACITY];  // Update request, the body starts at HEADER_CAPACITY
 #ifdef BQ27441_FUEL_GAUGE
 BQ27441 lipo;
+poll_result lipoInit = POLL_DONE;    // POLL_PENDING while the gauge is initialized after a POR
+bool lipoOnline = false;             // Gauge answered in setup(), skipped otherwise
+GoldenImage lipoImage;               // Golden image of the battery, written to the gauge after a POR
+#ifdef BQ27441_BUS_PROFILE
+bq27441_bus_stats lipoBus;           // I2C traffic to the gauge since boot
+#endif
 #endif
 
 
+#if defined(BQ27441_FUEL_GAUGE) && defined(BQ27441_BUS_PROFILE)
 //
-// Main program to read all sensor data and upload it to ThingSpeak
+// Gauge I2C traffic so far: transactions/bytes per command group, read wait and timeouts
 //
-void uploadData(const char * server) 
+void lipoBusReport(Print & out)
 {
-    if (client.connect(server, 80)) {
-    
-    int adc_mV = analogRead(A0) * volt_div_const;
-    // Take average of two readings to get rid of noise
-    delay(1);
-    adc_mV = ( adc_mV + analogRead(A0)*volt_div_const ) / 2 ;
+  out.print(F("I2C std=")); out.print(lipoBus.standard.transactions);
+  out.print('/'); out.print(lipoBus.standard.bytes);
+  out.print(F(" ctl=")); out.print(lipoBus.control.transactions);
+  out.print('/'); out.print(lipoBus.control.bytes);
+  out.print(F(" blk=")); out.print(lipoBus.block.transactions);
+  out.print('/'); out.print(lipoBus.block.bytes);
+  out.print(F(" wait=")); out.print(lipoBus.standard.waitMicros + lipoBus.control.waitMicros + lipoBus.block.waitMicros);
+  out.print(F("us to=")); out.print(lipoBus.standard.timeouts + lipoBus.control.timeouts + lipoBus.block.timeouts);
+}
+#endif //BQ27441_BUS_PROFILE
+
+
+//
+// Read all sensor data into thingSample, and the ThingSpeak status into thingStatus
+//
+void measureData()
+{
+    int adc_mV = adcBattery;
+    if (adc_mV < 0)                 // Radio is on (loop), read it anyway
+      adc_mV = adcReadMillivolts(adc_config);
+    adcBattery = -1;
     float adcVoltage = adc_mV/1000.0F;
     
-    String thingStatus;
+    PayloadBuffer status(thingStatus);
     if (adc_mV < floating_voltage) {
       wemosBattery = BATTERY_FLOAT;
-      thingStatus = F("No Battery ");
+      status.print(F("No Battery "));
     }
     else if (adc_mV < lockout_voltage) {
       wemosBattery = BATTERY_CRITICAL;
-      thingStatus = F("Battery Critical ");
+      status.print(F("Battery Critical "));
     }
     #ifndef DEBUG_FAST_UPDATE  // Skip deep-sleep modes for fastest updates and battery discharge
     else if (adc_mV < hibernate_voltage) {
       wemosBattery = BATTERY_LOW;
-      thingStatus = F("Battery Low ");
+      status.print(F("Battery Low "));
     }
     else if (adc_mV < recharge_voltage) {
       wemosBattery = BATTERY_NORMAL;
-      thingStatus = F("Battery Normal ");
+      status.print(F("Battery Normal "));
     }
     #endif //DEBUG_FAST_UPDATE
     else {
       wemosBattery = BATTERY_FULL;
-      thingStatus = F("Battery Full ");
+      status.print(F("Battery Full "));
     }
 
     #ifdef I2C_BME280_ADDR
-    // Measure BME280 sensors
-    float bmeTemperature = bme.readTemperature();
-    float bmeHumidity = bme.readHumidity();
-    float seaLevelPressure = bme.seaLevelForAltitude(thing_altitude,bme.readPressure()) / 100.0F; //(hPa)
+    // Measure BME280 sensors, one forced conversion
+    Bme280Sample bmeData = {};
+    bool bmeOk = bme280Collect(bmeData) ||  // Started in setup(), it converted while WiFi connected
+                 bme280Read(bmeData);       // None running (loop), convert now
+    float bmeTemperature = bmeData.temperature / 100.0F;
+    float bmeHumidity = bmeData.humidity / 1024.0F;
+    float seaLevelPressure = bme280SeaLevelPressure(bmeData, thing_altitude); //(hPa)
     #endif //I2C_BME280_ADDR
        
     #ifdef BQ27441_FUEL_GAUGE
-    // Get battery data from Battery Fuel Gauge
-    float        lipoVoltage = (float)lipo.voltage() / 1000.0F;
-    unsigned int lipoSOC = lipo.soc();
-    int          lipoCurrent = lipo.current(AVG);
-    unsigned int lipoCapacity = lipo.capacity(AVAIL_FULL);
-    uint8  lipoSoHStat = lipo.soh(SOH_STAT);
-    uint16 lipoFlags = lipo.flags();
-    thingStatus += "(" + String(lipoCapacity) + "mAh"+")";
-    if (lipoSoHStat == 0x02)   // SoH based on default Qmax - Estimation
-      thingStatus += "*";
-    if (lipoSoHStat == 0x03)   // SoH based on learned Qmax - Most accurate
-      thingStatus += "**";
-    thingStatus += " " + String(lipoCurrent) + "mA [ ";
-    if (lipoFlags & BQ27441_FLAG_DSG)
-      thingStatus += "Dsg ";
-    if (lipoFlags & BQ27441_FLAG_FC)
-      thingStatus += "Ful ";
-    uint16 lipoGaugeStat = lipo.status();
-    uint16 lipoQmax = bq27441_ReadQmax(lipo);
-    uint16 lipoRaTable[15];
-    bq27441_ReadRaTable(lipo,lipoRaTable);
-    if (lipoGaugeStat & BQ27441_STATUS_VOK)
-      thingStatus += "Vok ";
-    if (lipoGaugeStat & BQ27441_STATUS_RUP_DIS)
-      thingStatus += "Rdi ";
-    if (lipoGaugeStat & BQ27441_STATUS_QMAX_UP)  
-      thingStatus += "Qup ";
-    if (lipoGaugeStat & BQ27441_STATUS_RES_UP)
-      thingStatus += "Rup ";
-    thingStatus +=  "] Q=" + String(lipoQmax) + " R=";
-    for (int i = 0; i < 15; i++)
-      thingStatus += String(lipoRaTable[i])+",";
+    // Get battery data from Battery Fuel Gauge, all standard commands in one burst
+    // A gauge that stops answering is skipped, its reads fail fast (see lipo.lastError())
+    bq27441_snapshot lipoData = {};
+    uint16 lipoGaugeStat = 0;
+    uint16 lipoQmax = 0;
+    uint16 lipoRaTable[15] = {0};
+    lipo.clearError();
+    bool lipoOk = lipoOnline && lipo.snapshot(lipoData);
+    if (lipoOk) {
+      lipoGaugeStat = lipo.status();
+      BQ27441::ConfigSession config(lipo);    // Enter config mode once for both reads
+      lipoQmax = bq27441_ReadQmax(lipo);
+      bq27441_ReadRaTable(lipo,lipoRaTable);
+    }
+    lipoOk = lipoOk && (lipo.lastError() == BQ27441_OK);
+    if (lipoOk) {
+      // A SOC_INT pulse is over before we can sense it, the SoC tells if it woke us
+      wakeReason = wakeSource(wake_policy, lipoData.soc);
+      wakeMarkSoc(lipoData.soc);
+    }
+    if (wakeReason == WAKE_GAUGE)
+      status.print(F("(SoC wake) "));
+    // Once the gauge has learned the battery, keep what it learned for the next POR
+    if (lipoOk) {
+      if (!bq27441_SaveLearnedOnUpdate(lipoImage, lipoGaugeStat, lipoQmax, lipoRaTable)) {
+        #ifdef USE_SERIAL
+        USE_SERIAL.println(F("Warning: Failed to save the learned battery parameters."));
+        #endif
+      }
+    }
+    float        lipoVoltage = (float)lipoData.voltage / 1000.0F;
+    unsigned int lipoSOC = lipoData.soc;
+    int          lipoCurrent = lipoData.avgCurrent;
+    unsigned int lipoCapacity = lipoData.fullAvailCapacity;
+    uint8  lipoSoHStat = lipoData.sohStatus;
+    uint16 lipoFlags = lipoData.flags;
+    if (lipoOk) {
+      status.print("("); status.print(lipoCapacity); status.print(F("mAh)"));
+      if (lipoSoHStat == 0x02)   // SoH based on default Qmax - Estimation
+        status.print("*");
+      if (lipoSoHStat == 0x03)   // SoH based on learned Qmax - Most accurate
+        status.print("**");
+      status.print(" "); status.print(lipoCurrent); status.print(F("mA [ "));
+      if (lipoFlags & BQ27441_FLAG_DSG)
+        status.print("Dsg ");
+      if (lipoFlags & BQ27441_FLAG_FC)
+        status.print("Ful ");
+      if (lipoGaugeStat & BQ27441_STATUS_VOK)
+        status.print("Vok ");
+      if (lipoGaugeStat & BQ27441_STATUS_RUP_DIS)
+        status.print("Rdi ");
+      if (lipoGaugeStat & BQ27441_STATUS_QMAX_UP)  
+        status.print("Qup ");
+      if (lipoGaugeStat & BQ27441_STATUS_RES_UP)
+        status.print("Rup ");
+      status.print("]");
+      #ifdef ADAPTIVE_SLEEP
+      // The interval and what it was computed from. The average current now mostly covers
+      // the deep-sleep, the cost of a wake is the one read as the last wake went to sleep.
+      SleepInputs sleepInputs = { (uint8)lipoSOC, lipoData.fullCapacity, wakeLastCurrent(), wakeLastAwakeMs() };
+      uint32 sleepSeconds = sleepInterval(sleep_budget, sleepInputs);
+      adaptiveTimer = sleepSeconds * 1000000;
+      status.print(F(" T=")); status.print(sleepSeconds); status.print(F("s("));
+      status.print(sleepInputs.soc); status.print(F("%,"));
+      status.print(sleepInputs.capacity); status.print(F("mAh,"));
+      status.print(sleepInputs.avgCurrent); status.print(F("mA,"));
+      status.print(sleepInputs.awakeMs); status.print(F("ms)"));
+      #endif
+      status.print(F(" Q=")); status.print(lipoQmax); status.print(F(" R="));
+      for (int i = 0; i < 15; i++) {
+        status.print(lipoRaTable[i]);
+        status.print(",");
+      }
+    }
+    else {
+      status.print(F("(Gauge error ")); status.print((int)lipo.lastError()); status.print(")");
+    }
+    #ifdef BQ27441_BUS_PROFILE
+    status.print(" ");
+    lipoBusReport(status);
+    #endif
     #endif //BQ27441_FUEL_GAUGE
+    #ifdef USE_SERIAL
+    if (status.truncated())
+      USE_SERIAL.println(F("Warning: Status truncated."));
+    #endif
 
-    // Construct API request body
-    String body = F("field1=");
-    body += String(adcVoltage,3);
+    // Keep the readings compact, they may wait in the RTC sample log
+    thingSample = LogSample();
+    thingSample.adcVoltage = adc_mV;
     #ifdef I2C_BME280_ADDR
-    body += F("&field2=");
-    body += String(bmeTemperature);
-    body += F("&field3=");
-    body += String(bmeHumidity);
-    body += F("&field4=");
-    body += String(seaLevelPressure);
+    if (bmeOk) {
+      thingSample.temperature = bmeData.temperature;
+      thingSample.humidity = (bmeData.humidity * 100 + 512) / 1024;
+      thingSample.pressure = seaLevelPressure * 100 + 0.5F;
+      thingSample.valid |= LOG_BME280;
+    }
     #endif //I2C_BME280_ADDR
-    
     #ifdef BQ27441_FUEL_GAUGE
-    body += F("&field5=");
-    body += String(lipoVoltage,3);    
-    body += F("&field6=");
-    body += String(lipoSOC);
+    if (lipoOk) {
+      thingSample.lipoVoltage = lipoData.voltage;
+      thingSample.lipoSoc = lipoSOC;
+      thingSample.valid |= LOG_GAUGE;
+    }
     #endif //BQ27441_FUEL_GAUGE
-    body += F("&status=");
-    body += thingStatus;
 
     #ifdef USE_SERIAL
     USE_SERIAL.print(F("ESP8266: "));
     USE_SERIAL.print(adcVoltage,3); USE_SERIAL.println("V"); 
     #ifdef I2C_BME280_ADDR
     USE_SERIAL.print(F("BME280: "));
-    USE_SERIAL.println(String(bmeTemperature,1)+"C, " + String(bmeHumidity,1) + "%, " + String(seaLevelPressure,1) + "hPa"); 
+    USE_SERIAL.print(bmeTemperature,1); USE_SERIAL.print(F("C, "));
+    USE_SERIAL.print(bmeHumidity,1); USE_SERIAL.print(F("%, "));
+    USE_SERIAL.print(seaLevelPressure,1); USE_SERIAL.println(F("hPa"));
     #endif //I2C_BME280_ADDR
     #ifdef BQ27441_FUEL_GAUGE    
     USE_SERIAL.print(F("BQ27441: "));
-    USE_SERIAL.print("(Bat=" + String(lipoCapacity) + "mAh" + ")");
-    if (lipoSoHStat == 0x02)   // SoH based on default Qmax - Estimation
-      USE_SERIAL.print("*");
-    if (lipoSoHStat == 0x03)   // SoH based on learned Qmax - Most accurate
-      USE_SERIAL.print("**");
-    USE_SERIAL.print(" "+String(lipoVoltage,3) + "V, " + String(lipoSOC) + "%, " + String(lipoCurrent) + "mA [ ");
-    if (lipoFlags & BQ27441_FLAG_DSG)
-      USE_SERIAL.print("Dsg ");
-    if (lipoFlags & BQ27441_FLAG_FC)
-      USE_SERIAL.print("Ful ");
-    if (lipoGaugeStat & BQ27441_STATUS_VOK)
-      USE_SERIAL.print("Vok ");
-    if (lipoGaugeStat & BQ27441_STATUS_RUP_DIS)
-      USE_SERIAL.print("Rdi ");
-    if (lipoGaugeStat & BQ27441_STATUS_QMAX_UP)  
-      USE_SERIAL.print("Qup ");
-    if (lipoGaugeStat & BQ27441_STATUS_RES_UP)
-      USE_SERIAL.print("Rup ");
-    USE_SERIAL.print("] Qmax="); USE_SERIAL.println(lipoQmax);
-    USE_SERIAL.print("R_a=");
-    for (int i = 0; i < 15; i++) {
-      USE_SERIAL.print(lipoRaTable[i]); 
-      USE_SERIAL.print(",");
+    if (lipoOk) {
+      USE_SERIAL.print(F("(Bat=")); USE_SERIAL.print(lipoCapacity); USE_SERIAL.print(F("mAh)"));
+      if (lipoSoHStat == 0x02)   // SoH based on default Qmax - Estimation
+        USE_SERIAL.print("*");
+      if (lipoSoHStat == 0x03)   // SoH based on learned Qmax - Most accurate
+        USE_SERIAL.print("**");
+      USE_SERIAL.print(" "); USE_SERIAL.print(lipoVoltage,3); USE_SERIAL.print(F("V, "));
+      USE_SERIAL.print(lipoSOC); USE_SERIAL.print(F("%, "));
+      USE_SERIAL.print(lipoCurrent); USE_SERIAL.print(F("mA [ "));
+      if (lipoFlags & BQ27441_FLAG_DSG)
+        USE_SERIAL.print("Dsg ");
+      if (lipoFlags & BQ27441_FLAG_FC)
+        USE_SERIAL.print("Ful ");
+      if (lipoGaugeStat & BQ27441_STATUS_VOK)
+        USE_SERIAL.print("Vok ");
+      if (lipoGaugeStat & BQ27441_STATUS_RUP_DIS)
+        USE_SERIAL.print("Rdi ");
+      if (lipoGaugeStat & BQ27441_STATUS_QMAX_UP)  
+        USE_SERIAL.print("Qup ");
+      if (lipoGaugeStat & BQ27441_STATUS_RES_UP)
+        USE_SERIAL.print("Rup ");
+      USE_SERIAL.print("] Qmax="); USE_SERIAL.println(lipoQmax);
+      USE_SERIAL.print("R_a=");
+      for (int i = 0; i < 15; i++) {
+        USE_SERIAL.print(lipoRaTable[i]); 
+        USE_SERIAL.print(",");
+      }
+    }
+    else {
+      USE_SERIAL.print(F("Error "));
+      USE_SERIAL.print((int)lipo.lastError());
     }
     USE_SERIAL.println();
+    #ifdef BQ27441_BUS_PROFILE
+    char busReport[96];
+    PayloadBuffer report(busReport);
+    lipoBusReport(report);
+    USE_SERIAL.println(report.c_str());
+    #endif
     #endif //BQ27441_FUEL_GAUGE
     #endif //USE_SERIAL
+} // end of measureData()
 
+
+//
+// Start a ThingSpeak field, as form data or as a JSON member. field1 always comes first.
+//
+void printField(Print & out, uint8 field, bool json)
+{
+  if (field > 1)
+    out.print(json ? ',' : '&');
+  out.print(json ? F("\"field") : F("field"));
+  out.print(field);
+  out.print(json ? F("\":") : F("="));
+}
+
+
+//
+// ThingSpeak fields of a sample, the ones that were not read are left out
+//
+void printFields(Print & out, const LogSample & sample, bool json)
+{
+  printField(out, 1, json);
+  out.print(sample.adcVoltage / 1000.0F, 3);
+  if (sample.valid & LOG_BME280) {
+    printField(out, 2, json);
+    out.print(sample.temperature / 100.0F, 2);
+    printField(out, 3, json);
+    out.print(sample.humidity / 100.0F, 2);
+    printField(out, 4, json);
+    out.print(sample.pressure / 100.0F, 2);
+  }
+  if (sample.valid & LOG_GAUGE) {
+    printField(out, 5, json);
+    out.print(sample.lipoVoltage / 1000.0F, 3);
+    printField(out, 6, json);
+    out.print(sample.lipoSoc);
+  }
+}
+
+// Longest printFields() output, at the widest values of the LogSample members
+const size_t fields_max = sizeof("\"field1\":65.535,\"field2\":-327.68,\"field3\":655.35,"
+                                 "\"field4\":42949672.95,\"field5\":65.535,\"field6\":255") - 1;
+
+
+//
+// Print text as the contents of a JSON string. Quotes and backslashes are escaped, tabs and
+// line breaks too; other control characters become spaces. At most twice the text length.
+//
+void printJsonText(Print & out, const char * text)
+{
+  for (; *text; text++) {
+    char c = *text;
+    if (c == '"' || c == '\\') {
+      out.print('\\');
+      out.print(c);
+    } else if (c == '\n') {
+      out.print(F("\\n"));
+    } else if (c == '\r') {
+      out.print(F("\\r"));
+    } else if (c == '\t') {
+      out.print(F("\\t"));
+    } else {
+      out.print(((uint8)c < ' ') ? ' ' : c);
+    }
+  }
+}
+
+//
+// ThingSpeak bulk-update body of the sample log, oldest first. Timestamps are relative
+// (delta_t, seconds since the previous sample), the status goes with the newest sample.
+//
+void bulkBody(PayloadBuffer & body)
+{
+  static_assert(BODY_CAPACITY > sizeof("{\"write_api_key\":\"\",\"updates\":[]}") + sizeof(write_api_key) +
+                LOG_CAPACITY * (sizeof(",{\"delta_t\":65535,}") + fields_max) +
+                sizeof(",\"status\":\"\"") + 2 * STATUS_CAPACITY, "BODY_CAPACITY can't hold a full sample log");
+
+  body.print(F("{\"write_api_key\":\""));
+  body.print(write_api_key);
+  body.print(F("\",\"updates\":["));
+  for (uint8 i = 0; i < logCount(); i++) {
+    const LogSample & sample = logSample(i);
+    body.print((i > 0) ? F(",{\"delta_t\":") : F("{\"delta_t\":"));
+    body.print(sample.deltaSec);
+    body.print(',');
+    printFields(body, sample, true);
+    if (i == logCount() - 1) {
+      body.print(F(",\"status\":\""));
+      printJsonText(body, thingStatus);
+      body.print('"');
+    }
+    body.print('}');
+  }
+  body.print(F("]}"));
+}
+
+//
+// Print text as a form-urlencoded value. Letters, digits and "-_.~" stay, spaces become '+',
+// anything else (the '%' of the SoC, '&', '=', '+') is %XX. At most three times the length.
+//
+void printFormText(Print & out, const char * text)
+{
+  for (; *text; text++) {
+    char c = *text;
+    if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      out.print(c);
+    } else if (c == ' ') {
+      out.print('+');
+    } else {
+      out.print('%');
+      out.print("0123456789ABCDEF"[(uint8)c >> 4]);
+      out.print("0123456789ABCDEF"[(uint8)c & 0x0F]);
+    }
+  }
+}
+
+//
+// ThingSpeak update body of the latest readings
+//
+void updateBody(PayloadBuffer & body)
+{
+  static_assert(BODY_CAPACITY > fields_max + sizeof("&status=") + 3 * STATUS_CAPACITY,
+                "BODY_CAPACITY can't hold the fields and the status");
+
+  printFields(body, thingSample, false);
+  body.print(F("&status="));
+  printFormText(body, thingStatus);
+}
+
+
+//
+// Post the update body, built at thingRequest + HEADER_CAPACITY, on the open ThingSpeak
+// connection: a bulk update of the sample log (see bulkBody()), or else an update of the
+// latest readings. The headers are moved right in front of it, so the whole request
+// leaves in one write instead of a string of small segments.
+//
+bool postData(const PayloadBuffer & body, bool bulk, bool keepAlive)
+{
     // Prepare the HTML document to post
-    client.print( F("POST /update HTTP/1.1\n") );
-    client.print( F("Host: api.thingspeak.com\nConnection: close\nX-THINGSPEAKAPIKEY: ") );
-    client.print( write_api_key );
-    client.print( F("\nContent-Type: application/x-www-form-urlencoded\nContent-Length: ") );
-    client.print( body.length() );
-    client.print( "\n\n" );
-    client.print( body );
-    client.print( "\n\n" );
+    char headerText[HEADER_CAPACITY];
+    PayloadBuffer headers(headerText);
+    if (bulk) {
+      headers.print( F("POST /channels/") );
+      headers.print( channel_id );
+      headers.print( F("/bulk_update.json HTTP/1.1\r\n") );
+      headers.print( F("Host: api.thingspeak.com\r\nContent-Type: application/json\r\n") );
+    } else {
+      headers.print( F("POST /update HTTP/1.1\r\n") );
+      headers.print( F("Host: api.thingspeak.com\r\nX-THINGSPEAKAPIKEY: ") );
+      headers.print( write_api_key );
+      headers.print( F("\r\nContent-Type: application/x-www-form-urlencoded\r\n") );
+    }
+    headers.print( keepAlive ? F("Connection: keep-alive\r\n") : F("Connection: close\r\n") );
+    headers.print( F("Content-Length: ") );
+    headers.print( body.length() );
+    headers.print( "\r\n\r\n" );
+    if (headers.truncated()) {
+      #ifdef USE_SERIAL
+      USE_SERIAL.println(F("Error: Request headers truncated."));
+      #endif
+      return false;
+    }
+
+    char * request = thingRequest + HEADER_CAPACITY - headers.length();
+    memcpy(request, headerText, headers.length());
+    size_t length = headers.length() + body.length();
+    client.setNoDelay(true);      // Nothing else follows, don't let Nagle hold the last segment
+    bool sent = (client.write((const uint8_t *)request, length) == length);
+    client.flush();               // Until the request is acknowledged
+    return sent;
+} // end of postData()
+
+
+//
+// Connect to the server at its cached address, skipping the DNS lookup. The address is
+// looked up again if the cache is stale or the connect to the cached address failed.
+//
+bool serverConnect(const char * server)
+{
+  IPAddress address;
+  if (dnsCached(server, address, dns_ttl) && client.connect(address, 80))
+    return true;
+  return dnsLookup(server, address) && client.connect(address, 80);
+}
+
+
+//
+// serverConnect(), and the time (ms) it took into connectMs when it is the longest yet
+//
+bool timedConnect(const char * server, uint32 & connectMs)
+{
+  unsigned long connectStart = millis();
+  bool connected = serverConnect(server);
+  connectMs = max(connectMs, (uint32)(millis() - connectStart));
+  return connected;
+}
+
+
+//
+// Post the update and read the whole response, so a kept connection is ready for the next
+// update. keepAlive is cleared if the server is closing the connection.
+//   UPLOAD_SENT:     Accepted, /update answers with the new entry ID
+//   UPLOAD_RETRY:    No response, or a server error, worth another try now
+//   UPLOAD_LATER:    Rate limited, /update answers 0 within 15 sec of the last update
+//   UPLOAD_REJECTED: Any other client error (write API key, channel), a retry won't help
+//
+UploadStatus sendUpdate(const PayloadBuffer & body, bool bulk, bool & keepAlive)
+{
+  if (!postData(body, bulk, keepAlive))
+    return UPLOAD_RETRY;
+  char responseText[16];
+  PayloadBuffer responseBody(responseText);
+  HttpResponse response;
+  if (!httpReadResponse(client, response, &responseBody, http_response_timeout))
+    return UPLOAD_RETRY;
+  keepAlive = keepAlive && response.keepAlive;
+
+  #ifdef USE_SERIAL
+  USE_SERIAL.print(F("ThingSpeak: "));
+  USE_SERIAL.print(response.status);
+  USE_SERIAL.print(" ");
+  USE_SERIAL.println(responseBody.c_str());
+  #endif
+  if (response.status == 429)
+    return UPLOAD_LATER;
+  if (response.status >= 500)
+    return UPLOAD_RETRY;
+  if (response.status < 200 || response.status >= 300)
+    return UPLOAD_REJECTED;
+  if (!bulk && atol(responseBody.c_str()) == 0)
+    return UPLOAD_LATER;
+  return UPLOAD_SENT;
+}
+
+
+#ifdef BQ27441_FUEL_GAUGE
+//
+// Advance the Fuel Gauge initialization, if one is running, and report when it completes
+//
+void pollFuelGauge()
+{
+  if (lipoInit != POLL_PENDING)
+    return;
+  lipoInit = bq27441_PollInit(lipo);
+  #ifdef USE_SERIAL
+  if (lipoInit == POLL_DONE && bq27441_InitSkipped())
+    USE_SERIAL.println(F("Fuel Gauge already holds the golden image."));
+  else if (lipoInit == POLL_DONE)
+    USE_SERIAL.println(F("Fuel Gauge initialized."));
+  if (lipoInit == POLL_ERROR)
+    USE_SERIAL.println(F("Warning: Failed to initialize Fuel Gauge parameters."));
+  #endif 
+  // The POR also reset GPOUT, set it up again to wake us
+  if (lipoInit == POLL_DONE && !wakeConfigureGauge(lipo, wake_policy)) {
+    #ifdef USE_SERIAL
+    USE_SERIAL.println(F("Warning: Failed to configure Fuel Gauge GPOUT wake."));
+    #endif 
   }
-  client.stop();
-} // end of uploadData()
+}
+#endif //BQ27441_FUEL_GAUGE
+
+
+//
+// The readings in thingSample have to be reported, always without REPORT_BY_EXCEPTION
+//
+bool reportSample()
+{
+  #ifdef REPORT_BY_EXCEPTION
+  #ifndef RTC_SAMPLE_BATCH
+  if (reportRestart) {
+    reportRestart = false;
+    return true;              // Found due by the wake before, see storeData()
+  }
+  #endif
+  if (!reportDue(thingSample, report_deadband)) {
+    #ifdef USE_SERIAL
+    USE_SERIAL.println(F("Readings within their deadbands, not reported."));
+    #endif
+    return false;
+  }
+  #endif
+  return true;
+}
+
+
+//
+// Add thingSample to the sample log, it counts as reported once it is logged
+//
+void storeSample()
+{
+  logAppend(thingSample);
+  #ifdef REPORT_BY_EXCEPTION
+  reportSent(thingSample);
+  #endif
+}
+
+
+//
+// Radio of the wake after a deep-sleep of timer (us): off until it is the one that uploads
+// the batch, or the oldest logged sample would wait longer than the report heartbeat.
+// Reporting by exception without a batch, always off (see storeData()).
+//
+RFMode nextWakeRadio(uint32 timer)
+{
+  #ifdef RTC_SAMPLE_BATCH
+  bool upload = logUploadDue(RTC_SAMPLE_BATCH);
+  #ifdef REPORT_BY_EXCEPTION
+  upload = upload || (logCount() > 0 && logAge() + timer / 1000000 >= report_deadband.heartbeat);
+  #endif
+  if (!upload)
+    return WAKE_RF_DISABLED;
+  #elif defined(REPORT_BY_EXCEPTION)
+  return WAKE_RF_DISABLED;
+  #endif
+  return WAKE_RF_DEFAULT;
+}
 
 
+//
+// Deep-sleep on battery, for the adaptive interval when the gauge gave one, else for timer
+//
+void batterySleep(uint32 timer)
+{
+  if (adaptiveTimer)
+    timer = adaptiveTimer;
+  #ifdef ADAPTIVE_SLEEP
+  // What this wake drew, averaged over about its last second, for the next interval
+  if (lipoOnline)
+    wakeMarkCurrent(lipo.current(AVG));
+  #endif
+  wakeDeepSleep(wake_policy, timer, nextWakeRadio(timer));
+}
+
+
+#ifdef BQ27441_FUEL_GAUGE
+#ifdef USE_SERIAL
+//
+// Battery ID typed on the serial port as "battery=<ID>" within battery_id_window
+//
+bool readBatteryId(char * batteryId, size_t size)
+{
+  USE_SERIAL.print(F("Type battery=<ID> to change the battery: "));
+  char line[32];
+  USE_SERIAL.setTimeout(battery_id_window);
+  size_t length = USE_SERIAL.readBytesUntil('\n', line, sizeof(line) - 1);
+  while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == ' '))
+    length--;
+  line[length] = 0;
+  USE_SERIAL.println((const char *)line);
+  if (strncmp(line, "battery=", 8) != 0 || line[8] == 0)
+    return false;
+  strncpy(batteryId, line + 8, size - 1);
+  batteryId[size - 1] = 0;
+  return true;
+}
+#endif //USE_SERIAL
+
+
+//
+// Select the golden image of the battery at runtime, by the first of:
+//   - the battery ID saved in EEPROM, typed on the serial port at a power-on
+//   - the design capacity the gauge still holds from its last initialization
+//   - battery_id and battery_capacity
+// Returns true if a saved image was found.
+//
+bool selectBatteryImage()
+{
+  char batteryId[20];
+  #ifdef USE_SERIAL
+  if (wakeReason == WAKE_POWER_ON && readBatteryId(batteryId, sizeof(batteryId)))
+    bq27441_SaveBatteryId(batteryId);
+  #endif
+  if (bq27441_LoadBatteryId(batteryId, sizeof(batteryId)))
+    return bq27441_SelectImage(lipoImage, batteryId, battery_capacity);
+  if (lipoOnline && !(lipo.flags() & BQ27441_FLAG_ITPOR)) {
+    uint16 capacity = lipo.capacity(DESIGN);
+    if (capacity > 0)
+      return bq27441_SelectImage(lipoImage, NULL, capacity);
+  }
+  return bq27441_SelectImage(lipoImage, battery_id, battery_capacity);
+}
+#endif //BQ27441_FUEL_GAUGE
+
+
+//
+// Start associating, the radio connects in the background while we measure
+//
 void startWiFi()
 {
   #ifdef USE_SERIAL
   USE_SERIAL.print(F("Hostname: "));
   USE_SERIAL.println(WiFi.hostname());
-  USE_SERIAL.print(F("Connecting ."));
   #endif 
 
   // WiFi auto-connect is ON by default, when we are called, WiFi maybe connected already.
   // https://github.com/esp8266/Arduino/issues/2186
   if (WiFi.status() != WL_CONNECTED)
-    WiFi.begin(ssid, password);
-  
+    wifiFast = wifiBegin(ssid, password, wifi_lease_ttl);
+}
+
+
+//
+// Sensors can be read: the Fuel Gauge is out of config mode
+//
+bool sensorsReady()
+{
+  #ifdef BQ27441_FUEL_GAUGE
+  pollFuelGauge();
+  return (lipoInit != POLL_PENDING);
+  #else
+  return true;
+  #endif
+}
+
+
+//
+// Main program to read all sensor data and upload it to ThingSpeak. The readings are
+// taken while the radio associates, the connection is opened as soon as there is an IP,
+// and the update is posted when both are done: awake time is about max(connect, measure).
+// Without RTC_SAMPLE_BATCH an update that isn't sent goes into the sample log, and the
+// next upload posts the log with its readings in one bulk update.
+//
+void uploadData(const char * server) 
+{
+  PayloadBuffer body(thingRequest + HEADER_CAPACITY, BODY_CAPACITY);
+  bool measured = false;
+  bool linkDone = false;       // Connection to the server attempted
+  bool connected = false;
+  bool reused = false;         // Connection kept open from the previous upload
+  bool upload = true;          // There is something to post
+  #ifdef RTC_SAMPLE_BATCH
+  const bool bulk = true;      // The sample log, thingSample is in it
+  #else
+  bool bulk = false;           // The sample log of updates that failed, with thingSample
+  #endif
+  uint32 connectMs = 0;        // Longest server connect, counted against the upload budget
+
+  #ifdef USE_SERIAL
+  if (WiFi.status() != WL_CONNECTED)
+    USE_SERIAL.print(F("Connecting ."));
+  #endif 
   unsigned long wifiConnectStart = millis();
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    #ifdef USE_SERIAL
-    USE_SERIAL.print(".");
-    #endif 
-    if ( (millis()-wifiConnectStart) > wifi_connect_timeout ) {
+  unsigned long dotStart = wifiConnectStart;
+  while (!measured || !linkDone) {
+    if (!measured && sensorsReady()) {
+      measureData();
+      bool report = reportSample();
+      #ifndef RTC_SAMPLE_BATCH
+      bulk = (logCount() > 0);
+      #endif
+      if (bulk) {
+        if (report || logCount() > 0)
+          storeSample();        // Kept until it is uploaded, the latest goes with an upload
+        upload = (logCount() > 0);
+        if (upload)
+          bulkBody(body);
+      } else {
+        upload = report;
+        if (upload)
+          updateBody(body);
+      }
+      #ifdef USE_SERIAL
+      if (body.truncated())
+        USE_SERIAL.println(F("Warning: Update body truncated."));
+      #endif
+      measured = true;
+      if (!upload)
+        break;                  // Don't wait for WiFi, it goes down with deep-sleep
+    }
+
+    if (!linkDone && WiFi.status() == WL_CONNECTED) {
+      #ifdef USE_SERIAL
+      USE_SERIAL.println();
+      USE_SERIAL.print(F("Connected to "));
+      USE_SERIAL.print(ssid);
+      USE_SERIAL.print(F(", IP address: "));
+      USE_SERIAL.println(WiFi.localIP());
+      #endif 
+      if (!wifiFast)
+        wifiSaveLease(ssid);   // Joined after a scan and DHCP, next wake goes straight there
+      reused = client.connected();
+      connected = reused || timedConnect(server, connectMs);
+      linkDone = true;
+    }
+
+    if (!linkDone && wifiFast && (WiFi.status() == WL_NO_SSID_AVAIL ||
+        WiFi.status() == WL_CONNECT_FAILED || (millis()-wifiConnectStart) > wifi_lease_timeout)) {
+      // The AP moved or is gone, find it again
+      #ifdef USE_SERIAL
+      USE_SERIAL.print(F(" scan ."));
+      #endif 
+      wifiDropLease();
+      wifiFast = wifiBegin(ssid, password, wifi_lease_ttl);
+    }
+
+    if (!linkDone && (millis()-wifiConnectStart) > wifi_connect_timeout) {
       #ifdef USE_SERIAL
       USE_SERIAL.println();
       USE_SERIAL.println(F("Warning: Unable to connect to WiFi."));
       #endif 
-      ESP.deepSleep(sleep_timer);
+      if (measured && upload && !bulk)
+        storeSample();         // Posted with the next upload
+      batterySleep(sleep_timer);
+    }
+
+    if (!measured || !linkDone) {
+      delay(1);                // Let the WiFi stack run
+      #ifdef USE_SERIAL
+      if (!linkDone && (millis()-dotStart) >= 500) {
+        USE_SERIAL.print(".");
+        dotStart = millis();
+      }
+      #endif 
     }
   }
 
-  #ifdef USE_SERIAL
-  USE_SERIAL.println();
-  USE_SERIAL.print(F("Connected to "));
-  USE_SERIAL.println(ssid);
-  USE_SERIAL.print(F("IP address: "));
-  USE_SERIAL.println(WiFi.localIP());
-  #endif 
+  // On external power loop() uploads again soon, keep the connection for it
+  bool keepAlive = (wemosBattery == BATTERY_FLOAT || wemosBattery == BATTERY_FULL);
+  bool posted = false;
+  if (upload) {
+    // Retry on a new connection, backing off while the wake budget lasts. A kept connection
+    // the server closed while idle is replaced at once.
+    unsigned long postStart = millis();
+    UploadStatus status = connected ? sendUpdate(body, bulk, keepAlive) : UPLOAD_RETRY;
+    uint32 backoff = reused ? 0 : upload_backoff;
+    while (status == UPLOAD_RETRY &&
+           (millis()-postStart) + backoff + connectMs + http_response_timeout <= upload_budget) {
+      client.stop();
+      delay(backoff);
+      backoff = backoff ? 2 * backoff : upload_backoff;
+      status = timedConnect(server, connectMs) ? sendUpdate(body, bulk, keepAlive) : UPLOAD_RETRY;
+    }
+    posted = (status == UPLOAD_SENT);
+    if (!posted && !bulk && status != UPLOAD_REJECTED)
+      storeSample();           // Posted with the next upload
+    #ifdef USE_SERIAL
+    if (!posted)
+      USE_SERIAL.println(status == UPLOAD_REJECTED ? F("Error: Update rejected.") : F("Warning: Update not sent."));
+    #endif
+  }
+  if (posted) {
+    if (bulk)
+      logClear();
+    #ifdef REPORT_BY_EXCEPTION
+    else
+      reportSent(thingSample);
+    #endif
+  }
+  if (!keepAlive || (upload && !posted))
+    client.stop();
+} // end of uploadData()
+
+
+#if defined(RTC_SAMPLE_BATCH) || defined(REPORT_BY_EXCEPTION)
+//
+// Wake without radio: read all sensor data into the sample log, it is uploaded with the
+// batch. Without a batch, restart at once with the radio when the readings have to be
+// reported.
+//
+void storeData()
+{
+  while (!sensorsReady())
+    delay(1);
+  measureData();
+  if (!reportSample())
+    return;
+  #ifdef RTC_SAMPLE_BATCH
+  storeSample();
+  #else
+  wakeRestart(WAKE_RF_DEFAULT);
+  #endif
 }
+#endif
 
 
 //
@@ -285,18 +975,41 @@ void setup()
   USE_SERIAL.println();
   //USE_SERIAL.setDebugOutput(true);
   #endif
+
+  wakeReason = wakeSource(wake_policy);
+  #ifdef USE_SERIAL
+  if (wakeReason == WAKE_GAUGE)
+    USE_SERIAL.println(F("Woken up by the Fuel Gauge."));
+  #endif
   
-  // First thing is to set hostname before WiFi is reconnected (auto-connect is ON)
-  // Make up new hostname from our Chip ID (The MAC addr)
-  // Note: Max length for hostString is 32, increase array if hostname is longer
-  char hostString[16]  = {0};
-  sprintf(hostString, "esp8266_%06x", ESP.getChipId());
-  WiFi.hostname(hostString);
-  WiFi.mode(WIFI_STA); 
+  logLoad();
+  #ifdef RTC_SAMPLE_BATCH
+  // The radio is only on for the wake that uploads the batch (see nextWakeRadio()), and
+  // after a power-on
+  radioWake = (wakeRadio() != WAKE_RF_DISABLED);
+  #elif defined(REPORT_BY_EXCEPTION)
+  // The radio is only on after a power-on, and for the restart of a report (see storeData())
+  radioWake = (wakeRadio() != WAKE_RF_DISABLED);
+  reportRestart = radioWake && (wakeReason != WAKE_POWER_ON);
+  #endif
+
+  // Battery voltage before the radio starts, RF bursts add noise to the ADC
+  adcBattery = radioWake ? adcReadRadioOff(adc_config) : adcReadMillivolts(adc_config);
+
+  if (radioWake) {
+    // Then set hostname before WiFi is reconnected (auto-connect is ON)
+    // Make up new hostname from our Chip ID (The MAC addr)
+    // Note: Max length for hostString is 32, increase array if hostname is longer
+    char hostString[16]  = {0};
+    sprintf(hostString, "esp8266_%06x", ESP.getChipId());
+    WiFi.hostname(hostString);
+    WiFi.mode(WIFI_STA); 
+    startWiFi();             // Associates while the sensors are set up and read
+  }
 
   // Start hardware checks
   #ifdef I2C_BME280_ADDR
-  if (!bme.begin(I2C_BME280_ADDR)) {
+  if (!bme280Begin(bme_config)) {
     #ifdef USE_SERIAL
     USE_SERIAL.println(F("Error: Couldn't find a BME280 sensor."));
     #endif
@@ -305,39 +1018,45 @@ void setup()
   #ifdef USE_SERIAL
   USE_SERIAL.println(F("BME280 connected."));
   #endif
+  bme280Start();             // Converts while the gauge is set up, read in measureData()
   #endif //I2C_BME280_ADDR
 
   #ifdef BQ27441_FUEL_GAUGE
-  if (!lipo.begin()) // begin() will return true if communication is successful
-  {
-    #ifdef USE_SERIAL
-    USE_SERIAL.println(F("Error: Couldn't find BQ27441. (Battery must be plugged in)"));
-    #endif 
-    ESP.deepSleep(0);
-  }
+  #ifdef BQ27441_BUS_PROFILE
+  lipo.profileBus(&lipoBus);
+  #endif
+  lipo.setI2CTimeout(lipo_i2c_timeout);
+  lipoOnline = lipo.begin(); // begin() will return true if communication is successful
+  #ifdef USE_SERIAL
+  if (lipoOnline)
+    USE_SERIAL.println(F("BQ27441 connected."));
+  else
+    USE_SERIAL.println(F("Warning: Couldn't find BQ27441, skipping it. (Battery must be plugged in)"));
+  #endif
+  bool lipoImageSaved = selectBatteryImage();
   #ifdef USE_SERIAL
-  USE_SERIAL.println(F("BQ27441 connected."));
+  USE_SERIAL.print(F("BQ27441: Golden image "));
+  USE_SERIAL.print(lipoImage.name);
+  USE_SERIAL.println(lipoImageSaved ? F(".") : F(" (no battery data)."));
   #endif
-  if (lipo.flags() & BQ27441_FLAG_ITPOR) {
+  // After a POR, or a power-on that may come with a new battery or firmware. The init
+  // skips the write if the gauge already holds the image.
+  if (lipoOnline && ((lipo.flags() & BQ27441_FLAG_ITPOR) || wakeReason == WAKE_POWER_ON)) {
     #ifdef USE_SERIAL
-    USE_SERIAL.print(F("BQ27441: POR detected. "));
+    USE_SERIAL.println(F("BQ27441: POR or power-on. Initializing Fuel Gauge."));
     #endif 
-    if ( bq27441_InitParameters(lipo,terminate_voltage) ) {
-      #ifdef USE_SERIAL
-      USE_SERIAL.println(F("Fuel Gauge initialized."));
-      #endif 
-    } else {
-      #ifdef USE_SERIAL
-      USE_SERIAL.println();
-      USE_SERIAL.println(F("Warning: Failed to initialize Fuel Gauge parameters."));
-      #endif 
-    }
+    // Runs in the background while WiFi connects, see sensorsReady()
+    bq27441_BeginInit(lipo,terminate_voltage,lipoImage);
+    lipoInit = POLL_PENDING;
   }
   #endif //BQ27441_FUEL_GAUGE
 
-  startWiFi();
-
-  uploadData(api_endpoint);
+  if (radioWake)
+    uploadData(api_endpoint);
+  #if defined(RTC_SAMPLE_BATCH) || defined(REPORT_BY_EXCEPTION)
+  else
+    storeData();
+  #endif
 
   switch(wemosBattery) {
     
@@ -352,19 +1071,19 @@ void setup()
       #ifdef USE_SERIAL
       USE_SERIAL.println(F("Warning: Under voltage detected. Shut-Down ESP8266."));
       #endif
-      ESP.deepSleep(0);  
+      wakeDeepSleep(wake_policy, 0, nextWakeRadio(0));  
 
     case BATTERY_LOW:
       #ifdef USE_SERIAL
       USE_SERIAL.println(F("Warning: Hibernate voltage detected. Long deep-Sleep timer."));
       #endif
-      ESP.deepSleep(hibernate_timer);
+      batterySleep(hibernate_timer);
 
     case BATTERY_NORMAL:
       #ifdef USE_SERIAL
       USE_SERIAL.println(F("Running on battery, short deep-sleep timer."));
       #endif
-      ESP.deepSleep(sleep_timer);  
+      batterySleep(sleep_timer);  
    
     case BATTERY_FULL:
       #ifdef USE_SERIAL
@@ -372,6 +1091,10 @@ void setup()
       #endif
       break;
   } // end of switch()
+
+  // Without radio loop() can't upload, sleep until the wake that uploads
+  if (!radioWake)
+    batterySleep(sleep_timer);
 }  // end of setup()
 
 
@@ -392,7 +1115,7 @@ void loop()
       #ifdef USE_SERIAL
       USE_SERIAL.println(F("Running on battery, set deep-sleep mode."));
       #endif
-      ESP.deepSleep(sleep_timer);  
+      batterySleep(sleep_timer);  
     case BATTERY_FLOAT:
     case BATTERY_FULL:
       break;
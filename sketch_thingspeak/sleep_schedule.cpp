@@ -0,0 +1,32 @@
+/*
+ * Adaptive Deep-Sleep Schedule
+ * Interval from the charge left, the cost of a wake and a battery-life target, see sleep_schedule.h.
+ */
+
+#include "sleep_schedule.h"
+
+uint32 sleepInterval(const SleepBudget & budget, const SleepInputs & inputs)
+{
+  if (inputs.avgCurrent == 0 || inputs.awakeMs == 0)
+    return 0;                           // Nothing measured yet
+  if (inputs.avgCurrent > 0)
+    return budget.minInterval;          // Charging
+
+  // Average draw (uA) that makes the charge left last lifeDays
+  uint32 hours = max(budget.lifeDays, (uint16)1) * 24;
+  uint32 allowed = (uint32)inputs.soc * inputs.capacity * 10 / hours;
+  uint32 awake = (uint32)(-inputs.avgCurrent) * 1000;
+  if (awake <= allowed)
+    return budget.minInterval;
+  if (allowed <= budget.sleepCurrent)
+    return budget.maxInterval;          // Even sleeping costs more than the budget
+
+  // One wake and the sleep after it average to the allowed draw:
+  //   awake * awakeMs + sleepCurrent * interval = allowed * (awakeMs + interval)
+  uint64_t interval = (uint64_t)(awake - allowed) * inputs.awakeMs / 1000 / (allowed - budget.sleepCurrent);
+  if (interval < budget.minInterval)
+    return budget.minInterval;
+  if (interval > budget.maxInterval)
+    return budget.maxInterval;
+  return interval;
+}
@@ -0,0 +1,30 @@
+#ifndef sleep_schedule_h
+#define sleep_schedule_h
+
+#include <Arduino.h>
+
+// Adaptive deep-sleep interval. The charge left in the battery is spread over a target
+// battery life, and the interval is the shortest one whose wake and deep-sleep draw no
+// more than that on average. With plenty of charge the samples are dense, and they
+// thin out smoothly as the battery runs down.
+struct SleepBudget {
+  uint16 lifeDays;      // (days) Battery life to reach from the charge left
+  uint32 minInterval;   // (s) Shortest deep-sleep, also while charging
+  uint32 maxInterval;   // (s) Longest deep-sleep, at most 4294 (the timer is in us)
+  uint16 sleepCurrent;  // (uA) Deep-sleep draw of the board and the gauge
+};
+
+// What a schedule is computed from, the gauge readings and the last wake
+struct SleepInputs {
+  uint8 soc;            // (%) StateOfCharge()
+  uint16 capacity;      // (mAh) FullChargeCapacity()
+  int16_t avgCurrent;   // (mA) AverageCurrent() read as the last wake went to sleep, <0
+                        // discharging, 0 if unknown
+  uint32 awakeMs;       // (ms) How long the last wake took, 0 if unknown
+};
+
+// Deep-sleep interval (s) between the budget bounds, 0 while the cost of a wake is unknown
+// (keep the fixed timer). Pure, so it can be checked against made-up gauge readings.
+uint32 sleepInterval(const SleepBudget & budget, const SleepInputs & inputs);
+
+#endif //sleep_schedule_h
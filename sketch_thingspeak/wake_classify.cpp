@@ -0,0 +1,23 @@
+/*
+ * Wake Classifier
+ * Timer or gauge wake from the GPOUT line and the SoC marker, see wake_classify.h.
+ */
+
+#include "wake_classify.h"
+
+WakeSource wakeClassify(const WakePolicy & policy, bool deepSleepWake, uint32 timerMs,
+                        bool gpoutAsserted, uint8 sleepSoc, uint8 soc)
+{
+  if (!deepSleepWake)
+    return WAKE_POWER_ON;
+  if (!policy.gaugeWake)
+    return WAKE_TIMER;
+  if (gpoutAsserted)
+    return WAKE_GAUGE;                  // BAT_LOW still held
+  if (timerMs == 0)
+    return WAKE_GAUGE;                  // Only RST could end the sleep
+  if (policy.function == SOC_INT && sleepSoc != WAKE_SOC_UNKNOWN && soc != WAKE_SOC_UNKNOWN &&
+      abs((int)soc - (int)sleepSoc) >= policy.socDelta)
+    return WAKE_GAUGE;                  // SOC_INT pulsed while we slept
+  return WAKE_TIMER;
+}
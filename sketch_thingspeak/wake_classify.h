@@ -0,0 +1,32 @@
+#ifndef wake_classify_h
+#define wake_classify_h
+
+#include <SparkFunBQ27441.h>
+
+// Why the ESP8266 is awake
+enum WakeSource { WAKE_POWER_ON, WAKE_TIMER, WAKE_GAUGE };
+
+#define WAKE_NO_PIN 0xFF
+
+// Deep-sleep wake policy. With gaugeWake, the BQ27441 GPOUT (open-drain, active-low) is
+// wired to RST next to GPIO16: a SOC_INT pulse or a BAT_LOW level wakes the ESP8266 when
+// the battery state moves, and the deep-sleep timer is only a long heartbeat.
+struct WakePolicy {
+  bool gaugeWake;             // GPOUT is wired to RST
+  gpout_function function;    // SOC_INT: pulse every socDelta %, BAT_LOW: held while SOCF is set
+  uint8 socDelta;             // (%) SOC_INT interval, 1~100
+  uint32 heartbeatTimer;      // (us) Longest deep-sleep when the gauge can wake us
+  uint8 gpoutPin;             // GPIO that also senses GPOUT, or WAKE_NO_PIN
+};
+#define WAKE_SOC_UNKNOWN 0xFF
+
+// Classify a wake. It can't be told from the time slept: the RTC tick counter restarts
+// with the reset that ends deep-sleep. A wake is from the gauge when:
+//   - GPOUT is still asserted (BAT_LOW is a level, a SOC_INT pulse is only 1 ms wide)
+//   - no deep-sleep timer was set (timerMs 0), so only RST could end the sleep
+//   - with SOC_INT, the SoC moved by socDelta or more since the sleep started
+// Pure, so it can be checked against a simulated GPOUT line (see host_sim/wake_check.cpp).
+WakeSource wakeClassify(const WakePolicy & policy, bool deepSleepWake, uint32 timerMs,
+                        bool gpoutAsserted, uint8 sleepSoc, uint8 soc);
+
+#endif //wake_classify_h
@@ -0,0 +1,118 @@
+/*
+ * Deep-Sleep Wake Policy
+ * Lets the BQ27441 GPOUT pin wake the ESP8266 when the battery state moves, with the
+ * deep-sleep timer kept as a long heartbeat. A gauge wake is told from a timer wake by
+ * the GPOUT sense line and the SoC recorded at sleep, see wake_classify.h.
+ */
+
+#include <SparkFunBQ27441.h>
+#include "wake_policy.h"
+#include "rtc_memory.h"
+extern "C" {
+#include "user_interface.h"
+}
+
+// Saved in RTC memory when going to sleep
+struct WakeRecord {
+  uint32 timerMs;       // Deep-sleep timer that was set (0 = none)
+  uint16 radio;         // RFMode of the wake
+  int16_t awakeCurrent; // (mA) Gauge AverageCurrent() at sleep, 0 if it wasn't read
+  uint32 awakeMs;       // millis() at sleep, how long the wake took
+  uint32 soc;           // (%) SoC at sleep, WAKE_SOC_UNKNOWN if the gauge wasn't read
+};
+
+static uint8 markedSoc = WAKE_SOC_UNKNOWN;
+static int16_t markedCurrent = 0;
+
+bool wakeConfigureGauge(BQ27441 & lipo, const WakePolicy & policy)
+{
+  if (!policy.gaugeWake)
+    return true;
+  BQ27441::ConfigSession config(lipo, true);    // resim, OpConfig takes effect on exit
+  bool success = config.active();
+  success = success && lipo.setGPOUTPolarity(false);         // Active-low to pull RST
+  success = success && lipo.setGPOUTFunction(policy.function);
+  success = success && lipo.setSOCIDelta(constrain(policy.socDelta, 1, 100));
+  return config.exit() && success;
+}
+
+WakeSource wakeSource(const WakePolicy & policy, uint8 soc, GpoutReader readLine)
+{
+  bool deepSleepWake = (ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE);
+  bool asserted = false;
+  if (policy.gaugeWake && policy.gpoutPin != WAKE_NO_PIN)
+    asserted = (readLine(policy.gpoutPin) == LOW);
+
+  WakeRecord record;
+  if (!rtcLoad(RTC_BLOCK_WAKE, &record, sizeof(record)))
+    return deepSleepWake ? WAKE_TIMER : WAKE_POWER_ON;
+  return wakeClassify(policy, deepSleepWake, record.timerMs, asserted, record.soc, soc);
+}
+
+void wakeMarkSoc(uint8 soc)
+{
+  markedSoc = soc;
+}
+
+void wakeMarkCurrent(int16_t current)
+{
+  markedCurrent = current;
+}
+
+RFMode wakeRadio()
+{
+  WakeRecord record;
+  if (ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE ||
+      !rtcLoad(RTC_BLOCK_WAKE, &record, sizeof(record)))
+    return WAKE_RF_DEFAULT;
+  return (RFMode)record.radio;
+}
+
+uint32 wakeLastAwakeMs()
+{
+  WakeRecord record;
+  if (ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE ||
+      !rtcLoad(RTC_BLOCK_WAKE, &record, sizeof(record)))
+    return 0;
+  return record.awakeMs;
+}
+
+int16_t wakeLastCurrent()
+{
+  WakeRecord record;
+  if (ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE ||
+      !rtcLoad(RTC_BLOCK_WAKE, &record, sizeof(record)))
+    return 0;
+  return record.awakeCurrent;
+}
+
+uint32 wakeSleepTimer(const WakePolicy & policy, uint32 timer)
+{
+  if (!policy.gaugeWake || timer == 0)
+    return timer;
+  return max(timer, policy.heartbeatTimer);
+}
+
+// Record the sleep and go, timer (us) as given
+static void sleepFor(uint32 timer, RFMode radio)
+{
+  WakeRecord record;
+  record.timerMs = (timer + 999) / 1000;    // Only 0 without a timer
+  record.radio = radio;
+  record.awakeCurrent = markedCurrent;
+  record.awakeMs = millis();
+  record.soc = markedSoc;
+  rtcSave(RTC_BLOCK_WAKE, &record, sizeof(record));
+  rtcClockSleep(timer);
+  ESP.deepSleep(timer, radio);
+}
+
+void wakeDeepSleep(const WakePolicy & policy, uint32 timer, RFMode radio)
+{
+  sleepFor(wakeSleepTimer(policy, timer), radio);
+}
+
+void wakeRestart(RFMode radio)
+{
+  sleepFor(1, radio);
+}
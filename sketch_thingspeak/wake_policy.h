@@ -0,0 +1,45 @@
+#ifndef wake_policy_h
+#define wake_policy_h
+
+#include <SparkFunBQ27441.h>
+#include "wake_classify.h"
+
+// Reads the GPOUT sense line, digitalRead() on the device, a simulated line on the host
+typedef int (*GpoutReader)(uint8 pin);
+
+// Program GPOUT (active-low) and the SOC_INT delta, needed again after every gauge POR
+bool wakeConfigureGauge(BQ27441 & lipo, const WakePolicy & policy);
+
+// Classify this wake from the reset reason, the GPOUT sense line and, once the gauge was
+// read, its SoC against the one recorded at sleep (see wakeMarkSoc())
+WakeSource wakeSource(const WakePolicy & policy, uint8 soc = WAKE_SOC_UNKNOWN, GpoutReader readLine = digitalRead);
+
+// SoC read on this wake, recorded by wakeDeepSleep() to classify the next wake
+void wakeMarkSoc(uint8 soc);
+
+// (mA) Gauge AverageCurrent() read just before sleep, what this wake drew. Recorded by
+// wakeDeepSleep() for the next wake (see wakeLastCurrent()).
+void wakeMarkCurrent(int16_t current);
+
+// Radio of this wake, as set by wakeDeepSleep(). WAKE_RF_DEFAULT after a power-on.
+RFMode wakeRadio();
+
+// How long (ms) the wake before this one took, 0 after a power-on
+uint32 wakeLastAwakeMs();
+
+// (mA) What the wake before this one drew (see wakeMarkCurrent()), 0 if unknown
+int16_t wakeLastCurrent();
+
+// Deep-sleep timer to use: the heartbeat when the gauge can wake us, otherwise timer
+uint32 wakeSleepTimer(const WakePolicy & policy, uint32 timer);
+
+// Record the sleep in RTC memory, with the clock (see rtcClockSleep()), and go into
+// deep-sleep (0 = until RST), with the radio of the next wake on (WAKE_RF_DEFAULT) or
+// off (WAKE_RF_DISABLED)
+void wakeDeepSleep(const WakePolicy & policy, uint32 timer, RFMode radio = WAKE_RF_DEFAULT);
+
+// Restart at once through the shortest deep-sleep, the only way to change the radio of a
+// wake: on (WAKE_RF_DEFAULT) or off (WAKE_RF_DISABLED)
+void wakeRestart(RFMode radio);
+
+#endif //wake_policy_h
@@ -0,0 +1,68 @@
+/*
+ * WiFi Lease
+ * Access point and IP configuration of the last connection, see wifi_lease.h.
+ */
+
+#include "wifi_lease.h"
+#include "rtc_memory.h"
+
+// Saved in RTC memory once a scan and DHCP connected
+struct WifiRecord {
+  uint32 ssidCrc;       // crc32() of the SSID, a lease for another network is not used
+  uint8 bssid[6];       // MAC address of the access point
+  uint8 channel;
+  uint8 reserved;
+  uint32 address;       // IPv4 address, gateway, subnet mask and DNS server from DHCP
+  uint32 gateway;
+  uint32 subnet;
+  uint32 dns;
+  uint32 clockMs;       // rtcClock() of the DHCP lease
+};
+
+static bool loadLease(const char * ssid, uint32 ttl, WifiRecord & record)
+{
+  if (!rtcLoad(RTC_BLOCK_WIFI, &record, sizeof(record)))
+    return false;
+  if (record.ssidCrc != crc32(ssid, strlen(ssid)) || record.address == 0)
+    return false;
+  return (rtcClock() - record.clockMs) / 1000 < ttl;
+}
+
+bool wifiBegin(const char * ssid, const char * password, uint32 ttl)
+{
+  // The lease switches begin() between a BSSID and channel and a plain scan. Persistent, the
+  // core would rewrite the station config in flash at each switch.
+  WiFi.persistent(false);
+  WifiRecord record;
+  if (loadLease(ssid, ttl, record)) {
+    WiFi.config(IPAddress(record.address), IPAddress(record.gateway), IPAddress(record.subnet),
+                IPAddress(record.dns));
+    WiFi.begin(ssid, password, record.channel, record.bssid);
+    return true;
+  }
+  WiFi.config(IPAddress(), IPAddress(), IPAddress());  // Back to DHCP
+  WiFi.begin(ssid, password);
+  return false;
+}
+
+bool wifiSaveLease(const char * ssid)
+{
+  WifiRecord record;
+  record.ssidCrc = crc32(ssid, strlen(ssid));
+  memcpy(record.bssid, WiFi.BSSID(), sizeof(record.bssid));
+  record.channel = WiFi.channel();
+  record.reserved = 0;
+  record.address = (uint32)WiFi.localIP();
+  record.gateway = (uint32)WiFi.gatewayIP();
+  record.subnet = (uint32)WiFi.subnetMask();
+  record.dns = (uint32)WiFi.dnsIP();
+  record.clockMs = rtcClock();
+  return rtcSave(RTC_BLOCK_WIFI, &record, sizeof(record));
+}
+
+void wifiDropLease()
+{
+  WifiRecord record;
+  memset(&record, 0, sizeof(record));
+  rtcSave(RTC_BLOCK_WIFI, &record, sizeof(record));
+}
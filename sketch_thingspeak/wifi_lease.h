@@ -0,0 +1,21 @@
+#ifndef wifi_lease_h
+#define wifi_lease_h
+
+#include <ESP8266WiFi.h>
+
+// WiFi fast reconnect. The access point (BSSID and channel) and the IP configuration of
+// the last connection are kept in RTC memory as a lease. The next wake joins that access
+// point directly with a static IP, skipping the scan and the DHCP exchange.
+
+// Start associating. With a lease for ssid younger than ttl (s), join its access point
+// with its IP configuration and return true. Otherwise scan and use DHCP, return false.
+// The station config is not written to flash (WiFi.persistent(false)).
+bool wifiBegin(const char * ssid, const char * password, uint32 ttl);
+
+// Keep the connection that is up as the lease for ssid
+bool wifiSaveLease(const char * ssid);
+
+// Forget the lease, e.g. when it didn't connect, the next wifiBegin() scans again
+void wifiDropLease();
+
+#endif //wifi_lease_h